@@ -135,6 +135,11 @@ focal value		- set the focal length of the camera
 
 display			- display the current image on the screen
 
+resolution w h		- sets the size of the image to w x h pixels.
+			  Scene coordinates are in these pixels. A
+			  --resolution given on the command line
+			  takes precedence.
+
 
 LEX & BISON NOTES
 -----------------
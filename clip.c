@@ -0,0 +1,236 @@
+/*====================== clip.c ========================
+Viewport culling and guard band clipping.
+
+Primitives are checked against the screen once, when they are
+set up. Anything entirely outside the clip rectangle is thrown
+away. Anything inside the guard band (the screen grown by
+GUARD_BAND pixels on every side) is drawn as is, and the row
+and span loops skip the parts outside the clip rectangle.
+Only primitives reaching past the guard band are actually cut,
+which keeps every coordinate the rasterizer sees well inside
+the range of an int.
+
+The guard band depends only on the size of the screen, never on
+its clip rectangle, so tiles see exactly the same geometry as a
+screen drawn in one piece.
+==================================================*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "ml6.h"
+#include "matrix.h"
+#include "draw.h"
+#include "clip.h"
+
+/*======== int outside_clip() ==========
+Inputs:   screen s
+          struct matrix *points
+          int i
+          int n
+Returns: 1 if none of the pixels that the n points starting
+         at column i can cover are inside the clip rectangle
+
+The box is padded by a pixel to allow for the rounding done
+when points become pixels.
+====================*/
+int outside_clip( screen s, struct matrix *points, int i, int n ) {
+
+  double xmin, xmax, ymin, ymax;
+  int k;
+
+  xmin = xmax = points->m[0][i];
+  ymin = ymax = points->m[1][i];
+  for (k = 1; k < n; k++) {
+    xmin = fmin(xmin, points->m[0][i+k]);
+    xmax = fmax(xmax, points->m[0][i+k]);
+    ymin = fmin(ymin, points->m[1][i+k]);
+    ymax = fmax(ymax, points->m[1][i+k]);
+  }
+
+  //rows are flipped y
+  return !( xmax + 1 >= s->clip_x0 && xmin - 1 < s->clip_x1 &&
+            s->height - 1 - ymin + 1 >= s->clip_y0 &&
+            s->height - 1 - ymax - 1 < s->clip_y1 );
+}
+
+/*======== int outside_clip_box() ==========
+Inputs:   screen s
+          struct matrix *m
+          double *lo
+          double *hi
+Returns: 1 if the box from lo to hi, moved by the transform m,
+         cannot cover any pixel inside the clip rectangle
+
+Lets whole objects be thrown away before they are built. The
+screen space bounds come straight from the centre and half
+sizes of the box, without transforming its eight corners, and
+are padded like those of outside_clip.
+====================*/
+int outside_clip_box( screen s, struct matrix *m, double *lo, double *hi ) {
+
+  double c[2], e[2];
+  int r, k;
+
+  for (r = 0; r < 2; r++) {
+    c[r] = m->m[r][3];
+    e[r] = 0;
+    for (k = 0; k < 3; k++) {
+      c[r] += m->m[r][k] * (lo[k] + hi[k]) / 2;
+      e[r] += fabs(m->m[r][k]) * (hi[k] - lo[k]) / 2;
+    }
+  }
+
+  //rows are flipped y
+  return !( c[0] + e[0] + 1 >= s->clip_x0 && c[0] - e[0] - 1 < s->clip_x1 &&
+            s->height - 1 - (c[1] - e[1]) + 1 >= s->clip_y0 &&
+            s->height - 1 - (c[1] + e[1]) - 1 < s->clip_y1 );
+}
+
+/*======== int inside_guard_band() ==========
+Inputs:   screen s
+          struct matrix *points
+          int i
+          int n
+Returns: 1 if the n points starting at column i are all
+         inside the guard band of s
+====================*/
+int inside_guard_band( screen s, struct matrix *points, int i, int n ) {
+
+  int k;
+
+  for (k = 0; k < n; k++)
+    if ( !( points->m[0][i+k] >= -GUARD_BAND &&
+            points->m[0][i+k] <= s->width + GUARD_BAND &&
+            points->m[1][i+k] >= -GUARD_BAND &&
+            points->m[1][i+k] <= s->height + GUARD_BAND ) )
+      return 0;
+  return 1;
+}
+
+/*======== static int clip_plane() ==========
+Inputs:   double in[][3]
+          int n
+          double out[][3]
+          int axis
+          double bound
+          int below
+Returns: The number of points in out
+
+Sutherland-Hodgman: cuts the n point polygon in to the side
+of the plane axis = bound where points are less than bound
+(below) or greater than it (!below).
+====================*/
+static int clip_plane( double in[][3], int n, double out[][3],
+                       int axis, double bound, int below ) {
+
+  double *a, *b;
+  double t;
+  int k, j, m, a_in, b_in;
+
+  m = 0;
+  for (k = 0; k < n; k++) {
+    a = in[k];
+    b = in[(k + 1) % n];
+    a_in = below ? a[axis] <= bound : a[axis] >= bound;
+    b_in = below ? b[axis] <= bound : b[axis] >= bound;
+    if ( a_in ) {
+      for (j = 0; j < 3; j++)
+        out[m][j] = a[j];
+      m++;
+    }
+    if ( a_in != b_in ) {
+      t = (bound - a[axis]) / (b[axis] - a[axis]);
+      for (j = 0; j < 3; j++)
+        out[m][j] = a[j] + t * (b[j] - a[j]);
+      out[m][axis] = bound;
+      m++;
+    }
+  }
+  return m;
+}
+
+/*======== int clip_triangle() ==========
+Inputs:   screen s
+          struct matrix *points
+          int i
+          struct matrix *fan
+Returns: The number of triangles added to fan
+
+Cuts triangle i of points to the guard band of s and adds
+what is left to fan as a fan of triangles
+====================*/
+int clip_triangle( screen s, struct matrix *points, int i, struct matrix *fan ) {
+
+  //each plane can add at most one point
+  double a[7][3], b[7][3];
+  int k, n;
+
+  for (k = 0; k < 3; k++) {
+    a[k][0] = points->m[0][i+k];
+    a[k][1] = points->m[1][i+k];
+    a[k][2] = points->m[2][i+k];
+  }
+  n = clip_plane(a, 3, b, 0, -GUARD_BAND, 0);
+  n = clip_plane(b, n, a, 0, s->width + GUARD_BAND, 1);
+  n = clip_plane(a, n, b, 1, -GUARD_BAND, 0);
+  n = clip_plane(b, n, a, 1, s->height + GUARD_BAND, 1);
+
+  for (k = 1; k < n - 1; k++)
+    add_polygon(fan, a[0][0], a[0][1], a[0][2],
+                a[k][0], a[k][1], a[k][2],
+                a[k+1][0], a[k+1][1], a[k+1][2]);
+  return n > 2 ? n - 2 : 0;
+}
+
+/*======== int clip_line() ==========
+Inputs:   screen s
+          double *p0
+          double *p1
+Returns: 0 if the line from p0 to p1 misses the guard band
+         of s, 1 otherwise
+
+Liang-Barsky: moves p0 and p1 (x, y, z triples) along the
+line until both are inside the guard band.
+====================*/
+int clip_line( screen s, double *p0, double *p1 ) {
+
+  double lo[2], hi[2], d[3];
+  double t0 = 0, t1 = 1, t;
+  int axis, k;
+
+  lo[0] = lo[1] = -GUARD_BAND;
+  hi[0] = s->width + GUARD_BAND;
+  hi[1] = s->height + GUARD_BAND;
+  for (k = 0; k < 3; k++)
+    d[k] = p1[k] - p0[k];
+
+  for (axis = 0; axis < 2; axis++) {
+    if ( d[axis] == 0 ) {
+      if ( !(p0[axis] >= lo[axis] && p0[axis] <= hi[axis]) )
+        return 0;
+      continue;
+    }
+    t = (lo[axis] - p0[axis]) / d[axis];
+    if ( d[axis] > 0 )
+      t0 = fmax(t0, t);
+    else
+      t1 = fmin(t1, t);
+    t = (hi[axis] - p0[axis]) / d[axis];
+    if ( d[axis] > 0 )
+      t1 = fmin(t1, t);
+    else
+      t0 = fmax(t0, t);
+  }
+  if ( !(t0 <= t1) )
+    return 0;
+
+  if ( t1 < 1 )
+    for (k = 0; k < 3; k++)
+      p1[k] = p0[k] + t1 * d[k];
+  if ( t0 > 0 )
+    for (k = 0; k < 3; k++)
+      p0[k] = p0[k] + t0 * d[k];
+  return 1;
+}
@@ -0,0 +1,18 @@
+#ifndef CLIP_H
+#define CLIP_H
+
+#include "matrix.h"
+#include "ml6.h"
+
+//how far in pixels geometry may reach past the edges of the
+//screen before it is clipped; inside it, only the loops that
+//walk rows and spans are clamped to the clip rectangle
+#define GUARD_BAND 4096
+
+int outside_clip( screen s, struct matrix *points, int i, int n );
+int outside_clip_box( screen s, struct matrix *m, double *lo, double *hi );
+int inside_guard_band( screen s, struct matrix *points, int i, int n );
+int clip_triangle( screen s, struct matrix *points, int i, struct matrix *fan );
+int clip_line( screen s, double *p0, double *p1 );
+
+#endif
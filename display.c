@@ -1,8 +1,8 @@
 /*====================== display.c ========================
-Contains functions for basic manipulation of a screen 
-represented as a 2 dimensional array of colors.
+Contains functions for basic manipulation of a screen
+represented as a 2 dimensional, row-major array of pixels.
 
-A color is an ordered triple of ints, with each value standing
+A pixel is an ordered triple of bytes, with each value standing
 for red, green and blue respectively
 ==================================================*/
 
@@ -10,11 +10,15 @@ for red, green and blue respectively
 #include <stdlib.h>
 #include <limits.h>
 #include <string.h>
-#include <errno.h>
-#include <unistd.h>
+#include <strings.h>
+#include <math.h>
 
 #include "ml6.h"
 #include "display.h"
+#include "raster.h"
+#include "hiz.h"
+#include "png.h"
+#include "qoi.h"
 
 
 /*======== void plot() ==========
@@ -26,43 +30,117 @@ Returns:
 Sets the color at pixel x, y to the color represented by c
 Note that s[0][0] will be the upper left hand corner
 of the screen.
-If you wish to change this behavior, you can change the indicies
-of s that get set. For example, using s[x][YRES-1-y] will have
-pixel 0, 0 located at the lower left corner of the screen
+If you wish to change this behavior, you can change the row
+of s that gets set. For example, using row y instead of
+height-1-y will have pixel 0, 0 located at the upper left
+corner of the screen
 ====================*/
 void plot(screen s, zbuffer zb, color c, int x, int y, double z) {
-  int newy = YRES - 1 - y;
-  z = (int)(z * 1000) / 1000;
-  if ( x >= 0 && x < XRES && newy >=0 && newy < YRES &&
-       zb[x][newy] <= z ) {
-    s[x][newy] = c;
-    zb[x][newy] = z;
+  int newy = s->height - 1 - y;
+  int i;
+  z = round_depth(z);
+  if ( x >= s->clip_x0 && x < s->clip_x1 &&
+       newy >= s->clip_y0 && newy < s->clip_y1 ) {
+    i = newy * s->width + x;
+    if ( zb->z[i] <= z ) {
+      s->pixels[i].red = c.red;
+      s->pixels[i].green = c.green;
+      s->pixels[i].blue = c.blue;
+      zb->z[i] = z;
+      if ( zb->hiz )
+        hiz_mark(zb, x, newy, z);
+    }
   }
 }
 
-/*======== void clear_screen() ==========
+/*======== screen new_screen() ==========
+Inputs:   int width
+         int height
+Returns: A newly allocated width x height screen
+
+The pixel memory is aligned to FB_ALIGN bytes.
+The contents of the screen are not cleared.
+====================*/
+screen new_screen( int width, int height ) {
+
+  screen s;
+  void *pixels;
+
+  s = (screen)malloc(sizeof(struct screen_t));
+  if ( !s || posix_memalign(&pixels, FB_ALIGN,
+                            (size_t)width * height * sizeof(pixel)) ) {
+    printf("error: could not allocate a %dx%d screen\n", width, height);
+    exit(1);
+  }
+  s->width = width;
+  s->height = height;
+  s->pixels = (pixel *)pixels;
+  s->clip_x0 = 0;
+  s->clip_y0 = 0;
+  s->clip_x1 = width;
+  s->clip_y1 = height;
+  s->bins = NULL;
+  return s;
+}
+
+/*======== void free_screen() ==========
 Inputs:   screen s
 Returns:
-Sets every color in screen s to black
+Frees the pixel memory, any raster bins and the screen itself
 ====================*/
-void clear_screen( screen s ) {
+void free_screen( screen s ) {
+  disable_binning(s);
+  free(s->pixels);
+  free(s);
+}
 
-  int x, y;
-  color c;
+/*======== zbuffer new_zbuffer() ==========
+Inputs:   int width
+         int height
+Returns: A newly allocated width x height zbuffer
+
+The depth memory is aligned to FB_ALIGN bytes.
+The contents of the zbuffer are not cleared.
+====================*/
+zbuffer new_zbuffer( int width, int height ) {
+
+  zbuffer zb;
+  void *z;
 
-  c.red = 0;
-  c.green = 0;
-  c.blue = 0;
+  zb = (zbuffer)malloc(sizeof(struct zbuffer_t));
+  if ( !zb || posix_memalign(&z, FB_ALIGN,
+                             (size_t)width * height * sizeof(double)) ) {
+    printf("error: could not allocate a %dx%d zbuffer\n", width, height);
+    exit(1);
+  }
+  zb->width = width;
+  zb->height = height;
+  zb->z = (double *)z;
+  zb->hiz = NULL;
+  return zb;
+}
+
+/*======== void free_zbuffer() ==========
+Inputs:   zbuffer zb
+Returns:
+Frees the depth memory, any hierarchical z tiles and
+the zbuffer itself
+====================*/
+void free_zbuffer( zbuffer zb ) {
+  disable_hiz(zb);
+  free(zb->z);
+  free(zb);
+}
 
-  /*
-  c.red = 255;
-  c.green = 255;
-  c.blue = 255;
-  */
+/*======== void clear_screen() ==========
+Inputs:   screen s
+Returns:
+Sets every color in screen s to black
+====================*/
+void clear_screen( screen s ) {
 
-  for ( y=0; y < YRES; y++ )
-    for ( x=0; x < XRES; x++)
-      s[x][y] = c;
+  //every channel of black is 0, so the whole buffer can be zeroed
+  memset( s->pixels, 0, (size_t)s->width * s->height * sizeof(pixel) );
 }
 
 /*======== void clear_zbuffer() ==========
@@ -72,33 +150,120 @@ Sets all entries in the zbufffer to LONG_MIN
 ====================*/
 void clear_zbuffer( zbuffer zb ) {
 
+  int i, n;
+
+  n = zb->width * zb->height;
+  for ( i=0; i < n; i++ )
+    zb->z[i] = LONG_MIN;
+  clear_hiz(zb);
+}
+
+/*======== void copy_layer() ==========
+Inputs:   screen s
+          zbuffer zb
+          screen ls
+          zbuffer lzb
+Returns:
+
+Starts s and zb off as copies of the layer ls, lzb (which
+must be the same size) instead of clearing them
+====================*/
+void copy_layer( screen s, zbuffer zb, screen ls, zbuffer lzb ) {
+
+  size_t n = (size_t)s->width * s->height;
+
+  memcpy( s->pixels, ls->pixels, n * sizeof(pixel) );
+  memcpy( zb->z, lzb->z, n * sizeof(double) );
+  load_hiz(zb);
+}
+
+/*======== void overlay_layer() ==========
+Inputs:   screen s
+          zbuffer zb
+          screen ls
+          zbuffer lzb
+Returns:
+
+Puts the layer ls, lzb on top of s and zb. Every pixel of
+the layer is z tested the way plot does, so it ends up the
+same as if whatever was drawn in to the layer had been drawn
+to s right then. Nothing can be binned for s at the time.
+====================*/
+void overlay_layer( screen s, zbuffer zb, screen ls, zbuffer lzb ) {
+
+  int x, y, i;
+
+  for ( y=0; y < s->height; y++ )
+    for ( x=0; x < s->width; x++ ) {
+      i = y * s->width + x;
+      if ( zb->z[i] <= lzb->z[i] ) {
+        s->pixels[i] = ls->pixels[i];
+        zb->z[i] = lzb->z[i];
+        if ( zb->hiz )
+          hiz_mark(zb, x, y, zb->z[i]);
+      }
+    }
+}
+
+/*======== void write_rgb() ==========
+Inputs:   screen s
+         FILE *f
+Returns:
+Writes the pixels of s to f as bare 8-bit RGB triples, row
+by row. Unless the pixels are padded they are already in
+that order, so the whole image is a single fwrite.
+====================*/
+void write_rgb( screen s, FILE *f ) {
+
+  unsigned char *row;
   int x, y;
+  pixel *p;
 
-  for ( y=0; y < YRES; y++ )
-    for ( x=0; x < XRES; x++)
-      zb[x][y] = LONG_MIN;
+  if ( sizeof(pixel) == 3 ) {
+    fwrite(s->pixels, 3, (size_t)s->width * s->height, f);
+    return;
+  }
+  row = (unsigned char *)malloc(3 * s->width);
+  for ( y=0; y < s->height; y++ ) {
+    p = s->pixels + y * s->width;
+    for ( x=0; x < s->width; x++) {
+      row[3*x] = p[x].red;
+      row[3*x+1] = p[x].green;
+      row[3*x+2] = p[x].blue;
+    }
+    fwrite(row, 3, s->width, f);
+  }
+  free(row);
+}
+
+/*======== static void write_p6() ==========
+Inputs:   screen s
+         FILE *f
+Returns:
+Writes s to f as a binary (P6) ppm
+====================*/
+static void write_p6( screen s, FILE *f ) {
+  fprintf(f, "P6\n%d %d\n%d\n", s->width, s->height, MAX_COLOR);
+  write_rgb(s, f);
 }
 
 /*======== void save_ppm() ==========
 Inputs:   screen s
          char *file
 Returns:
-Saves screen s as a valid ppm file using the
-settings in ml6.h
+Saves screen s as a valid binary ppm file using the
+dimensions of s and MAX_COLOR from ml6.h
 ====================*/
 void save_ppm( screen s, char *file) {
 
-  int x, y;
   FILE *f;
 
-  f = fopen(file, "w");
-  fprintf(f, "P3\n%d %d\n%d\n", XRES, YRES, MAX_COLOR);
-  for ( y=0; y < YRES; y++ ) {
-    for ( x=0; x < XRES; x++)
-
-      fprintf(f, "%d %d %d ", s[x][y].red, s[x][y].green, s[x][y].blue);
-    fprintf(f, "\n");
+  f = fopen(file, "wb");
+  if ( !f ) {
+    printf("error: could not write %s\n", file);
+    return;
   }
+  write_p6(s, f);
   fclose(f);
 }
 
@@ -108,26 +273,33 @@ Inputs:   screen s
 Returns:
 Saves the screen stored in s to the filename represented
 by file.
-If the extension for file is an image format supported
-by the "convert" command, the image will be saved in
-that format.
+PNG, PPM and QOI files are written directly. For any
+other extension that is an image format supported by the
+"convert" command, the image will be saved in that format.
 ====================*/
 void save_extension( screen s, char *file) {
 
-  int x, y;
   FILE *f;
   char line[256];
+  char *ext = strrchr(file, '.');
+
+  if ( ext && !strcasecmp(ext, ".png") ) {
+    save_png(s, file);
+    return;
+  }
+  if ( ext && !strcasecmp(ext, ".ppm") ) {
+    save_ppm(s, file);
+    return;
+  }
+  if ( ext && !strcasecmp(ext, ".qoi") ) {
+    save_qoi(s, file);
+    return;
+  }
 
   sprintf(line, "convert - %s", file);
 
   f = popen(line, "w");
-  fprintf(f, "P3\n%d %d\n%d\n", XRES, YRES, MAX_COLOR);
-  for ( y=0; y < YRES; y++ ) {
-    for ( x=0; x < XRES; x++)
-
-      fprintf(f, "%d %d %d ", s[x][y].red, s[x][y].green, s[x][y].blue);
-    fprintf(f, "\n");
-  }
+  write_p6(s, f);
   pclose(f);
 }
 
@@ -139,32 +311,9 @@ Will display the screen s on your monitor
 ====================*/
 void display( screen s) {
 
-  int x, y;
   FILE *f;
 
   f = popen("display", "w");
-
-  fprintf(f, "P3\n%d %d\n%d\n", XRES, YRES, MAX_COLOR);
-  for ( y=0; y < YRES; y++ ) {
-    for ( x=0; x < XRES; x++)
-
-      fprintf(f, "%d %d %d ", s[x][y].red, s[x][y].green, s[x][y].blue);
-    fprintf(f, "\n");
-  }
+  write_p6(s, f);
   pclose(f);
 }
-
-void make_animation( char * name ) {
-
-  int e, f;
-  char name_arg[128];
-
-  sprintf(name_arg, "anim/%s*", name);
-  strncat(name, ".gif", 128);
-  printf("Making animation: %s\n", name);
-  f = fork();
-  if (f == 0) {
-    e = execlp("convert", "convert", "-delay", "3", name_arg, name, NULL);
-    printf("e: %d errno: %d: %s\n", e, errno, strerror(errno));
-  }
-}
@@ -1,13 +1,22 @@
 #ifndef DISPLAY_H
 #define DISPLAY_H
 
+#include <stdio.h>
+
 #include "ml6.h"
 
+screen new_screen( int width, int height );
+void free_screen( screen s );
+zbuffer new_zbuffer( int width, int height );
+void free_zbuffer( zbuffer zb );
+
 void plot(screen s, zbuffer zb, color c, int x, int y, double z);
 void clear_screen( screen s);
 void clear_zbuffer( zbuffer zb );
+void copy_layer( screen s, zbuffer zb, screen ls, zbuffer lzb );
+void overlay_layer( screen s, zbuffer zb, screen ls, zbuffer lzb );
+void write_rgb( screen s, FILE *f );
 void save_ppm( screen s, char *file);
 void save_extension( screen s, char *file);
 void display( screen s);
-void make_animation( char * name );
 #endif
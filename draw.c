@@ -1,6 +1,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <limits.h>
+#include <string.h>
+#include <pthread.h>
 
 #include "ml6.h"
 #include "display.h"
@@ -8,6 +10,12 @@
 #include "matrix.h"
 #include "math.h"
 #include "gmath.h"
+#include "raster.h"
+#include "halfspace.h"
+#include "hiz.h"
+#include "clip.h"
+
+int fill_mode = FILL_EDGE;
 
 /*======== void scanline_convert() ==========
   Inputs: struct matrix *points
@@ -22,7 +30,7 @@
   ====================*/
 void scanline_convert( struct matrix *points, int i, screen s, zbuffer zb, color c) {
 
-    int top, mid, bot, y;
+    int top, mid, bot, y, yfirst, ylast;
     int distance0, distance1, distance2;
     double x0, x1, y0, y1, y2, dx0, dx1, z0, z1, dz0, dz1;
     int flip = 0;
@@ -91,10 +99,18 @@ void scanline_convert( struct matrix *points, int i, screen s, zbuffer zb, color
     dz0 = distance0 > 0 ? (points->m[2][top]-points->m[2][bot])/distance0 : 0;
     dz1 = distance1 > 0 ? (points->m[2][mid]-points->m[2][bot])/distance1 : 0;
 
-    while ( y <= (int)points->m[1][top] ) {
+    //rows above the clip rectangle end the triangle, rows below
+    //it are only stepped through so the edges stay where they were
+    ylast = (int)points->m[1][top];
+    if ( ylast > s->height - 1 - s->clip_y0 )
+        ylast = s->height - 1 - s->clip_y0;
+    yfirst = s->height - s->clip_y1;
+
+    while ( y <= ylast ) {
         //printf("\tx0: %0.2f x1: %0.2f y: %d\n", x0, x1, y);
         //draw_line(x0, y, z0, x1, y, z1, s, zb, c);
-        draw_hline(x0, y, z0, x1, z1, s, zb, c);
+        if ( y >= yfirst )
+            draw_hline(x0, y, z0, x1, z1, s, zb, c);
     
         x0+= dx0;
         x1+= dx1;
@@ -138,16 +154,104 @@ void add_polygon( struct matrix *polygons,
     add_point(polygons, x2, y2, z2);
 }
 
+/*======== static void fill_triangle() ==========
+  Inputs:   struct matrix *polygons
+  int i
+  screen s
+  zbuffer zb
+  color c
+  Returns:
+  Fills in triangle i of polygons with the rasterizer picked
+  by fill_mode. The scanline walker leaves gaps between
+  triangles, so with it the outline is drawn over them as well.
+  Triangles the hierarchical z-buffer shows to be hidden
+  are skipped.
+
+  The triangle must be inside the guard band of s.
+  ====================*/
+static void fill_triangle( struct matrix *polygons, int i, screen s, zbuffer zb, color c ) {
+
+    if ( zb->hiz && hiz_reject_triangle(s, zb, polygons, i) )
+        return;
+
+    if ( fill_mode == FILL_EDGE ) {
+        halfspace_convert(polygons, i, s, zb, c);
+        return;
+    }
+
+    scanline_convert(polygons, i, s, zb, c);
+    draw_edge( polygons->m[0][i],
+               polygons->m[1][i],
+               polygons->m[2][i],
+               polygons->m[0][i+1],
+               polygons->m[1][i+1],
+               polygons->m[2][i+1],
+               s, zb, c);
+    draw_edge( polygons->m[0][i+2],
+               polygons->m[1][i+2],
+               polygons->m[2][i+2],
+               polygons->m[0][i+1],
+               polygons->m[1][i+1],
+               polygons->m[2][i+1],
+               s, zb, c);
+    draw_edge( polygons->m[0][i],
+               polygons->m[1][i],
+               polygons->m[2][i],
+               polygons->m[0][i+2],
+               polygons->m[1][i+2],
+               polygons->m[2][i+2],
+               s, zb, c);
+}
+
+/*======== void draw_triangle() ==========
+  Inputs:   struct matrix *polygons
+  int i
+  screen s
+  zbuffer zb
+  color c
+  Returns:
+  Draws triangle i of polygons, unless it is entirely outside
+  the clip rectangle of s. A triangle reaching past the guard
+  band is cut down to it first.
+  ====================*/
+void draw_triangle( struct matrix *polygons, int i, screen s, zbuffer zb, color c ) {
+
+    struct matrix *fan;
+    int t;
+
+    if ( outside_clip(s, polygons, i, 3) )
+        return;
+
+    if ( inside_guard_band(s, polygons, i, 3) ) {
+        fill_triangle(polygons, i, s, zb, c);
+        return;
+    }
+
+    //at most 7 points, so at most 5 triangles
+    fan = new_matrix(4, 15);
+    for (t = clip_triangle(s, polygons, i, fan) - 1; t >= 0; t--)
+        if ( !outside_clip(s, fan, t * 3, 3) )
+            fill_triangle(fan, t * 3, s, zb, c);
+    free_matrix(fan);
+}
+
+//face normals for draw_polygons to work in, one set per thread
+static __thread struct normals face_normals;
+
 /*======== void draw_polygons() ==========
   Inputs:   struct matrix *polygons
+  struct normals *normals
   screen s
   color c
   Returns:
-  Goes through polygons 3 points at a time, drawing
-  lines connecting each points to create bounding
-  triangles
+  Lights and draws each front facing triangle of polygons.
+  normals holds their surface normals, or is NULL to have them
+  worked out here. Back faces are all found in one pass before
+  anything is lit. If s is binning, the triangles are queued
+  for the tiled rasterizer instead.
   ====================*/
-void draw_polygons(struct matrix *polygons, screen s, zbuffer zb,
+void draw_polygons(struct matrix *polygons, struct normals *normals,
+                   screen s, zbuffer zb,
                    double *view, struct light **lights, int num_lights, color ambient,
                    double *areflect,
                    double *dreflect,
@@ -157,40 +261,100 @@ void draw_polygons(struct matrix *polygons, screen s, zbuffer zb,
         return;
     }
 
-    int point;
-    double *normal;
+    int f, num_front, point;
+    double normal[3];
 
-    for (point=0; point < polygons->lastcol-2; point+=3) {
+    if ( !normals ) {
+        normals = &face_normals;
+        calculate_normals(polygons, normals);
+    }
+    num_front = find_front_faces(normals, view);
 
-        normal = calculate_normal(polygons, point);
+    for (f = 0; f < num_front; f++) {
 
-        if ( dot_product(normal, view) > 0 ) {
-            color c = get_lighting(normal, view, ambient, lights, num_lights, areflect, dreflect, sreflect);
+        normal[0] = normals->x[ normals->front[f] ];
+        normal[1] = normals->y[ normals->front[f] ];
+        normal[2] = normals->z[ normals->front[f] ];
+        point = normals->front[f] * 3;
 
-            scanline_convert(polygons, point, s, zb, c);
+        color c = get_lighting(normal, view, ambient, lights, num_lights, areflect, dreflect, sreflect);
 
-            draw_line( polygons->m[0][point],
-                       polygons->m[1][point],
-                       polygons->m[2][point],
-                       polygons->m[0][point+1],
-                       polygons->m[1][point+1],
-                       polygons->m[2][point+1],
-                       s, zb, c);
-            draw_line( polygons->m[0][point+2],
-                       polygons->m[1][point+2],
-                       polygons->m[2][point+2],
-                       polygons->m[0][point+1],
-                       polygons->m[1][point+1],
-                       polygons->m[2][point+1],
-                       s, zb, c);
-            draw_line( polygons->m[0][point],
-                       polygons->m[1][point],
-                       polygons->m[2][point],
-                       polygons->m[0][point+2],
-                       polygons->m[1][point+2],
-                       polygons->m[2][point+2],
-                       s, zb, c);
-        }
+        if ( s->bins )
+            bin_triangle(s, polygons, point, c);
+        else
+            draw_triangle(polygons, point, s, zb, c);
+    }
+}
+
+/*======== void add_triangle() ==========
+  Inputs:   struct triangles *tris
+  int p0
+  int p1
+  int p2
+  Returns:
+  Adds the triangle made of columns p0, p1 and p2 of a point
+  matrix to tris
+  ====================*/
+void add_triangle( struct triangles *tris, int p0, int p1, int p2 ) {
+
+    int *v;
+
+    grow_triangles(tris, tris->count + 1);
+    v = tris->v + 3 * tris->count++;
+    v[0] = p0;
+    v[1] = p1;
+    v[2] = p2;
+}
+
+/*======== void draw_triangles() ==========
+  Inputs:   struct matrix *points
+  struct triangles *tris
+  struct normals *normals
+  screen s
+  color c
+  Returns:
+  draw_polygons for indexed triangles. Each point is only
+  transformed once, however many triangles share it; the
+  three points of a front facing triangle are copied out to
+  be drawn or binned after it is lit. The triangles are drawn
+  in the same order, and come out the same, as they would
+  from a polygon matrix.
+  ====================*/
+void draw_triangles(struct matrix *points, struct triangles *tris,
+                    struct normals *normals, screen s, zbuffer zb,
+                    double *view, struct light **lights, int num_lights, color ambient,
+                    double *areflect,
+                    double *dreflect,
+                    double *sreflect) {
+
+    double corners[4][3];
+    double *rows[4] = {corners[0], corners[1], corners[2], corners[3]};
+    struct matrix face = {rows, 4, 3, 3};
+    int f, k, r, num_front, *v;
+    double normal[3];
+
+    if ( !normals ) {
+        normals = &face_normals;
+        calculate_indexed_normals(points, tris, normals);
+    }
+    num_front = find_front_faces(normals, view);
+
+    for (f = 0; f < num_front; f++) {
+
+        normal[0] = normals->x[ normals->front[f] ];
+        normal[1] = normals->y[ normals->front[f] ];
+        normal[2] = normals->z[ normals->front[f] ];
+        v = tris->v + normals->front[f] * 3;
+        for (k = 0; k < 3; k++)
+            for (r = 0; r < 4; r++)
+                corners[r][k] = points->m[r][ v[k] ];
+
+        color c = get_lighting(normal, view, ambient, lights, num_lights, areflect, dreflect, sreflect);
+
+        if ( s->bins )
+            bin_triangle(s, &face, 0, c);
+        else
+            draw_triangle(&face, 0, s, zb, c);
     }
 }
 
@@ -240,8 +404,209 @@ void add_box( struct matrix * polygons,
     add_polygon(polygons, x, y1, z, x, y1, z1, x1, y1, z1);
 }//end add_box
 
+/*
+  A sphere or torus tessellated once, in its own unit space,
+  as shared points and triangles. Spheres have radius 1 and
+  tori radii r1 and r2, one of which is 1. Each one drawn is an
+  instance: the unit shape's points with a transform to put
+  them in place.
+*/
+struct shape {
+    int type;
+    int step;
+    double r1, r2;
+    struct matrix *points;
+    struct triangles tris;
+    struct shape *next;
+};
+
+#define SHAPE_SPHERE 0
+#define SHAPE_TORUS 1
+
+//every shape made so far, shared by the drawing threads
+static struct shape *shapes = NULL;
+static pthread_mutex_t shape_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*======== static void make_sphere() ==========
+  Inputs:   struct shape *sh
+  Returns:
+  Fills in the points and triangles of a unit sphere with
+  sh->step steps, laid out as generate_sphere does. Each
+  angle's sine and cosine is only worked out once.
+  ====================*/
+static void make_sphere( struct shape *sh ) {
+
+    int step = sh->step, n = step + 1;
+    int p0, p1, p2, p3, lat, longt;
+    double *cr = (double *)malloc(4 * n * sizeof(double));
+    double *sr = cr + n, *cc = sr + n, *sc = cc + n;
+
+    for (p0 = 0; p0 <= step; p0++) {
+        cr[p0] = cos(2 * M_PI * p0 / step);
+        sr[p0] = sin(2 * M_PI * p0 / step);
+        cc[p0] = cos(M_PI * p0 / step);
+        sc[p0] = sin(M_PI * p0 / step);
+    }
+    sh->points = new_matrix(4, step * n);
+    for (lat = 0; lat < step; lat++)
+        for (longt = 0; longt <= step; longt++)
+            add_point(sh->points, cc[longt], sc[longt] * cr[lat], sc[longt] * sr[lat]);
+    free(cr);
+
+    for ( lat = 0; lat < step; lat++ ) {
+        for ( longt = 0; longt < step; longt++ ) {
+            p0 = lat * n + longt;
+            p1 = p0 + 1;
+            p2 = (p1 + n) % (n * step);
+            p3 = (p0 + n) % (n * step);
+            if (longt < n - 2)
+                add_triangle( &sh->tris, p0, p1, p2 );
+            if (longt > 0 )
+                add_triangle( &sh->tris, p0, p2, p3 );
+        }
+    }
+}
+
+/*======== static void make_torus() ==========
+  Inputs:   struct shape *sh
+  Returns:
+  Fills in the points and triangles of a torus with radii
+  sh->r1 and sh->r2 and sh->step steps, laid out as
+  generate_torus does
+  ====================*/
+static void make_torus( struct shape *sh ) {
+
+    int step = sh->step;
+    int p0, p1, p2, p3, lat, longt;
+    double *c = (double *)malloc(2 * step * sizeof(double));
+    double *sn = c + step, ring;
+
+    for (p0 = 0; p0 < step; p0++) {
+        c[p0] = cos(2 * M_PI * p0 / step);
+        sn[p0] = sin(2 * M_PI * p0 / step);
+    }
+    sh->points = new_matrix(4, step * step);
+    for (lat = 0; lat < step; lat++)
+        for (longt = 0; longt < step; longt++) {
+            ring = sh->r1 * c[longt] + sh->r2;
+            add_point(sh->points, c[lat] * ring, sh->r1 * sn[longt], -sn[lat] * ring);
+        }
+    free(c);
+
+    for ( lat = 0; lat < step; lat++ ) {
+        for ( longt = 0; longt < step; longt++ ) {
+            p0 = lat * step + longt;
+            if (longt == step - 1)
+                p1 = p0 - longt;
+            else
+                p1 = p0 + 1;
+            p2 = (p1 + step) % (step * step);
+            p3 = (p0 + step) % (step * step);
+            add_triangle( &sh->tris, p0, p3, p2 );
+            add_triangle( &sh->tris, p0, p2, p1 );
+        }
+    }
+}
+
+/*======== static struct shape *find_shape() ==========
+  Inputs:   int type
+  int step
+  double r1
+  double r2
+  Returns: The unit shape of type with step steps (and radii
+  r1 and r2 for a torus), made the first time it is asked for
+  ====================*/
+static struct shape *find_shape( int type, int step, double r1, double r2 ) {
+
+    struct shape *sh;
+
+    pthread_mutex_lock(&shape_lock);
+    for (sh = shapes; sh; sh = sh->next)
+        if (sh->type == type && sh->step == step && sh->r1 == r1 && sh->r2 == r2)
+            break;
+    if (!sh) {
+        sh = (struct shape *)calloc(1, sizeof(struct shape));
+        sh->type = type;
+        sh->step = step;
+        sh->r1 = r1;
+        sh->r2 = r2;
+        if (type == SHAPE_SPHERE)
+            make_sphere(sh);
+        else
+            make_torus(sh);
+        sh->next = shapes;
+        shapes = sh;
+    }
+    pthread_mutex_unlock(&shape_lock);
+    return sh;
+}
+
+/*======== static void add_shape() ==========
+  Inputs:   struct matrix *points
+  struct triangles *tris
+  struct shape *sh
+  Returns:
+  Adds the points and triangles of sh to points and tris
+  ====================*/
+static void add_shape( struct matrix *points, struct triangles *tris,
+                       struct shape *sh ) {
+
+    int base = points->lastcol, n = sh->points->lastcol;
+    int k, *v, *u = sh->tris.v;
+
+    reserve_matrix(points, base + n);
+    for (k = 0; k < 4; k++)
+        memcpy(points->m[k] + base, sh->points->m[k], n * sizeof(double));
+    points->lastcol += n;
+
+    grow_triangles(tris, tris->count + sh->tris.count);
+    v = tris->v + 3 * tris->count;
+    for (k = 0; k < 3 * sh->tris.count; k++)
+        v[k] = u[k] + base;
+    tris->count += sh->tris.count;
+}
+
+/*======== int lod_step() ==========
+  Inputs:   struct matrix *m
+  double r
+  double tolerance
+  int step
+  Returns: The number of steps to draw a sphere or torus of
+  radius r with, or step if tolerance is 0
+
+  Picks the fewest steps, out of the levels from LOD_MIN_STEP
+  up to LOD_MAX_STEP, that keep every edge of the rings within
+  tolerance pixels of the true circle once m puts it on the
+  screen. Screen x and y are just the first two rows of m, so
+  the radius on screen is at most r times the largest singular
+  value of their first three columns. A ring of n steps strays
+  from its circle by R (1 - cos(pi / n)), which is at most
+  R (pi / n)^2 / 2, so no trig is needed. Only the levels are
+  ever asked for, so only they end up in the shape cache.
+  ====================*/
+int lod_step( struct matrix *m, double r, double tolerance, int step ) {
+
+    double a, b, c, scale, need;
+
+    if ( tolerance <= 0 )
+        return step;
+
+    a = m->m[0][0] * m->m[0][0] + m->m[0][1] * m->m[0][1] + m->m[0][2] * m->m[0][2];
+    b = m->m[0][0] * m->m[1][0] + m->m[0][1] * m->m[1][1] + m->m[0][2] * m->m[1][2];
+    c = m->m[1][0] * m->m[1][0] + m->m[1][1] * m->m[1][1] + m->m[1][2] * m->m[1][2];
+    scale = sqrt((a + c) / 2 + sqrt((a - c) * (a - c) / 4 + b * b));
+    need = M_PI * sqrt(fabs(r) * scale / (2 * tolerance));
+
+    //4, 6, 8, 12, 16, 24, ...
+    for (step = LOD_MIN_STEP; step < need && step < LOD_MAX_STEP; )
+        step = step % 3 ? step * 3 / 2 : step * 4 / 3;
+    return step;
+}
+
 /*======== void add_sphere() ==========
   Inputs:   struct matrix * points
+  struct triangles *tris
+  struct matrix *instance
   double cx
   double cy
   double cz
@@ -249,58 +614,23 @@ void add_box( struct matrix * polygons,
   double step
   Returns:
 
-  adds all the points for a sphere with center
-  (cx, cy, cz) and radius r.
+  adds the points and triangles of a unit sphere to points
+  and tris, and folds the move to (cx, cy, cz) and scale by r
+  that turn it in to the sphere wanted in to instance, which
+  starts out as the current coordinate system. Multiplying
+  points by instance then puts it in place.
 
-  should call generate_sphere to create the
-  necessary points
+  The unit spheres are made once per step, so no sines or
+  cosines are needed after the first.
   ====================*/
-void add_sphere( struct matrix * edges,
+void add_sphere( struct matrix * points, struct triangles *tris,
+                 struct matrix *instance,
                  double cx, double cy, double cz,
                  double r, int step ) {
 
-    struct matrix *points = generate_sphere(cx, cy, cz, r, step);
-
-    int p0, p1, p2, p3, lat, longt;
-    int latStop, longStop, latStart, longStart;
-    latStart = 0;
-    latStop = step;
-    longStart = 0;
-    longStop = step;
-
-    step++;
-    for ( lat = latStart; lat < latStop; lat++ ) {
-        for ( longt = longStart; longt < longStop; longt++ ) {
-
-            p0 = lat * (step) + longt;
-            p1 = p0+1;
-            p2 = (p1+step) % (step * (step-1));
-            p3 = (p0+step) % (step * (step-1));
-
-            //printf("p0: %d\tp1: %d\tp2: %d\tp3: %d\n", p0, p1, p2, p3);
-            if (longt < step - 2)
-                add_polygon( edges, points->m[0][p0],
-                             points->m[1][p0],
-                             points->m[2][p0],
-                             points->m[0][p1],
-                             points->m[1][p1],
-                             points->m[2][p1],
-                             points->m[0][p2],
-                             points->m[1][p2],
-                             points->m[2][p2]);
-            if (longt > 0 )
-                add_polygon( edges, points->m[0][p0],
-                             points->m[1][p0],
-                             points->m[2][p0],
-                             points->m[0][p2],
-                             points->m[1][p2],
-                             points->m[2][p2],
-                             points->m[0][p3],
-                             points->m[1][p3],
-                             points->m[2][p3]);
-        }
-    }
-    free_matrix(points);
+    add_shape(points, tris, find_shape(SHAPE_SPHERE, step, 0, 0));
+    translate_matrix(instance, cx, cy, cz);
+    scale_matrix(instance, r, r, r);
 }
 
 /*======== void generate_sphere() ==========
@@ -350,6 +680,8 @@ struct matrix * generate_sphere(double cx, double cy, double cz,
 
 /*======== void add_torus() ==========
   Inputs:   struct matrix * points
+  struct triangles *tris
+  struct matrix *instance
   double cx
   double cy
   double cz
@@ -358,59 +690,24 @@ struct matrix * generate_sphere(double cx, double cy, double cz,
   double step
   Returns:
 
-  adds all the points required to make a torus
-  with center (cx, cy, cz) and radii r1 and r2.
-
-  should call generate_torus to create the
-  necessary points
+  add_sphere for a torus with center (cx, cy, cz) and radii
+  r1 and r2. The unit torus has the same proportions, scaled
+  so that r1 (or r2 if r1 is 0) is 1, and is made once per
+  step and proportions.
   ====================*/
-void add_torus( struct matrix * edges,
+void add_torus( struct matrix * points, struct triangles *tris,
+                struct matrix *instance,
                 double cx, double cy, double cz,
                 double r1, double r2, int step ) {
 
-    struct matrix *points = generate_torus(cx, cy, cz, r1, r2, step);
-
-    int p0, p1, p2, p3, lat, longt;
-    int latStop, longStop, latStart, longStart;
-    latStart = 0;
-    latStop = step;
-    longStart = 0;
-    longStop = step;
-
-    //printf("points: %d\n", points->lastcol);
-
-    for ( lat = latStart; lat < latStop; lat++ ) {
-        for ( longt = longStart; longt < longStop; longt++ ) {
-            p0 = lat * step + longt;
-            if (longt == step - 1)
-                p1 = p0 - longt;
-            else
-                p1 = p0 + 1;
-            p2 = (p1 + step) % (step * step);
-            p3 = (p0 + step) % (step * step);
+    double k = r1 ? r1 : r2;
 
-            //printf("p0: %d\tp1: %d\tp2: %d\tp3: %d\n", p0, p1, p2, p3);
-            add_polygon( edges, points->m[0][p0],
-                         points->m[1][p0],
-                         points->m[2][p0],
-                         points->m[0][p3],
-                         points->m[1][p3],
-                         points->m[2][p3],
-                         points->m[0][p2],
-                         points->m[1][p2],
-                         points->m[2][p2]);
-            add_polygon( edges, points->m[0][p0],
-                         points->m[1][p0],
-                         points->m[2][p0],
-                         points->m[0][p2],
-                         points->m[1][p2],
-                         points->m[2][p2],
-                         points->m[0][p1],
-                         points->m[1][p1],
-                         points->m[2][p1]);
-        }
-    }
-    free_matrix(points);
+    if ( k )
+        add_shape(points, tris, find_shape(SHAPE_TORUS, step, r1 / k, r2 / k));
+    else
+        add_shape(points, tris, find_shape(SHAPE_TORUS, step, 0, 0));
+    translate_matrix(instance, cx, cy, cz);
+    scale_matrix(instance, k, k, k);
 }
 /*======== void generate_torus() ==========
   Inputs:   struct matrix * points
@@ -456,6 +753,26 @@ struct matrix * generate_torus( double cx, double cy, double cz,
     return points;
 }
 
+/*======== void free_shape_cache() ==========
+  Inputs:
+  Returns:
+  Frees every unit sphere and torus made so far
+  ====================*/
+void free_shape_cache() {
+
+    struct shape *sh;
+
+    pthread_mutex_lock(&shape_lock);
+    while (shapes) {
+        sh = shapes;
+        shapes = sh->next;
+        free_matrix(sh->points);
+        free_triangles(&sh->tris);
+        free(sh);
+    }
+    pthread_mutex_unlock(&shape_lock);
+}
+
 /*======== void add_circle() ==========
   Inputs:   struct matrix * points
   double cx
@@ -548,12 +865,12 @@ void add_curve( struct matrix *edges,
   int z
   Returns:
   adds point (x, y, z) to points and increment points.lastcol
-  if points is full, should call grow on points
+  if points is full, reserve_matrix makes more room
   ====================*/
 void add_point( struct matrix * points, double x, double y, double z) {
 
     if ( points->lastcol == points->cols )
-        grow_matrix( points, points->lastcol + 100 );
+        reserve_matrix( points, points->lastcol + 1 );
 
     points->m[0][ points->lastcol ] = x;
     points->m[1][ points->lastcol ] = y;
@@ -582,7 +899,7 @@ void add_edge( struct matrix * points,
   color c
   Returns:
   Go through points 2 at a time and call draw_line to add that line
-  to the screen
+  to the screen (or queue it, if s is binning)
   ====================*/
 void draw_lines( struct matrix * points, screen s, zbuffer zb, color c) {
 
@@ -592,15 +909,63 @@ void draw_lines( struct matrix * points, screen s, zbuffer zb, color c) {
     }
     int point;
     for (point=0; point < points->lastcol-1; point+=2)
-        draw_line( points->m[0][point],
-                   points->m[1][point],
-                   points->m[2][point],
-                   points->m[0][point+1],
-                   points->m[1][point+1],
-                   points->m[2][point+1],
-                   s, zb, c);
+        if ( s->bins )
+            bin_line(s, points, point, c);
+        else
+            draw_edge( points->m[0][point],
+                       points->m[1][point],
+                       points->m[2][point],
+                       points->m[0][point+1],
+                       points->m[1][point+1],
+                       points->m[2][point+1],
+                       s, zb, c);
 }// end draw_lines
 
+/*======== void draw_edge() ==========
+  Inputs:   double x0, double y0, double z0,
+  double x1, double y1, double z1,
+  screen s
+  zbuffer zb
+  color c
+  Returns:
+  Draws the line from (x0, y0, z0) to (x1, y1, z1), cut down
+  to the guard band of s first so the coordinates handed to
+  draw_line always fit in an int
+  ====================*/
+void draw_edge( double x0, double y0, double z0,
+                double x1, double y1, double z1,
+                screen s, zbuffer zb, color c) {
+
+    double p0[3] = {x0, y0, z0};
+    double p1[3] = {x1, y1, z1};
+
+    if ( clip_line(s, p0, p1) )
+        draw_line(p0[0], p0[1], p0[2], p1[0], p1[1], p1[2], s, zb, c);
+}
+
+/*======== static void put_pixel() ==========
+  Inputs:   pixel *p
+  double *zp
+  color c
+  double z
+  Returns:
+  plot, for a pixel already known to be inside the clip
+  rectangle: z tests and writes through the pointers
+  to the pixel and its depth. Returns 1 if it was written.
+  ====================*/
+static inline int put_pixel( pixel *p, double *zp, color c, double z ) {
+
+    z = round_depth(z);
+    if ( *zp <= z ) {
+        p->red = c.red;
+        p->green = c.green;
+        p->blue = c.blue;
+        *zp = z;
+        return 1;
+    }
+    return 0;
+}
+
 
 
 
@@ -612,6 +977,7 @@ void draw_line(int x0, int y0, double z0,
     int x, y, d, A, B;
     int dy_east, dy_northeast, dx_east, dx_northeast, d_east, d_northeast;
     int loop_start, loop_end;
+    int rmin, rmax, inside, i;
     double distance;
     double z, dz;
 
@@ -682,9 +1048,24 @@ void draw_line(int x0, int y0, double z0,
     dz = (z1 - z0) / distance;
     //printf("\t(%d, %d) -> (%d, %d)\tdistance: %0.2f\tdz: %0.2f\tz: %0.2f\n", x0, y0, x1, y1, distance, dz, z);
 
+    //x0 <= x1 after the swap, rows are flipped y
+    rmin = s->height - 1 - (y0 > y1 ? y0 : y1);
+    rmax = s->height - 1 - (y0 < y1 ? y0 : y1);
+    if ( x1 < s->clip_x0 || x0 >= s->clip_x1 ||
+         rmax < s->clip_y0 || rmin >= s->clip_y1 )
+        return;
+    inside = x0 >= s->clip_x0 && x1 < s->clip_x1 &&
+        rmin >= s->clip_y0 && rmax < s->clip_y1;
+
     while ( loop_start < loop_end ) {
 
-        plot( s, zb, c, x, y, z );
+        if ( inside ) {
+            i = (s->height - 1 - y) * s->width + x;
+            if ( put_pixel(s->pixels + i, zb->z + i, c, z) && zb->hiz )
+                hiz_mark(zb, x, s->height - 1 - y, zb->z[i]);
+        }
+        else
+            plot( s, zb, c, x, y, z );
         if ( (wide && ((A > 0 && d > 0) ||
                        (A < 0 && d < 0)))
              ||
@@ -709,9 +1090,14 @@ void draw_line(int x0, int y0, double z0,
 //draw_line(x0, y, z0, x1, y, z1, s, zb, c);
 void draw_hline(int x0, int y, double z0, int x1, double z1 , screen s, zbuffer zb, color c){
     double dz = (z0 - z1)/(x0 - x1);
+    int row = s->height - 1 - y;
+
+    int xt, x, xend, seg;
+    double zt, z, *zrow;
+    pixel *prow;
 
-    int xt, x;
-    double zt, z;
+    if ( row < s->clip_y0 || row >= s->clip_y1 )
+        return;
 
     if(x0 > x1){
         xt = x0;
@@ -722,10 +1108,50 @@ void draw_hline(int x0, int y, double z0, int x1, double z1 , screen s, zbuffer
         z1 = z;
     }
 
+    //z is stepped even where x is clipped or rejected so every
+    //pixel gets the same depth however the span is cut up
     z = z0;
-    for(x = x0; x < x1; x++){
-        plot(s, zb, c, x, y, z);
+    for(x = x0; x < x1 && x < s->clip_x0; x++)
         z += dz;
+    xend = x1 < s->clip_x1 ? x1 : s->clip_x1;
+
+    prow = s->pixels + row * s->width;
+    zrow = zb->z + row * zb->width;
+
+    if ( !zb->hiz ) {
+        for(; x < xend; x++){
+            put_pixel(prow + x, zrow + x, c, z);
+            z += dz;
+        }
+        return;
+    }
+
+    //one hierarchical z tile at a time
+    while ( x < xend ) {
+        seg = (x / HIZ_TILE + 1) * HIZ_TILE;
+        seg = seg < xend ? seg : xend;
+        switch ( hiz_test_span(zb, x, row, seg - x, z, dz) ) {
+        case HIZ_REJECT:
+            for(; x < seg; x++)
+                z += dz;
+            break;
+        case HIZ_ACCEPT:
+            for(; x < seg; x++){
+                zt = round_depth(z);
+                prow[x].red = c.red;
+                prow[x].green = c.green;
+                prow[x].blue = c.blue;
+                zrow[x] = zt;
+                hiz_mark(zb, x, row, zt);
+                z += dz;
+            }
+            break;
+        default:
+            for(; x < seg; x++){
+                if ( put_pixel(prow + x, zrow + x, c, z) )
+                    hiz_mark(zb, x, row, zrow[x]);
+                z += dz;
+            }
+        }
     }
-			
 }
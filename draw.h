@@ -5,32 +5,54 @@
 #include "matrix.h"
 #include "ml6.h"
 #include "symtab.h"
+#include "gmath.h"
+
+//triangle fill algorithms, picked with --rasterizer
+#define FILL_SCANLINE 0
+#define FILL_EDGE 1
+
+extern int fill_mode;
+
+//sphere and torus detail levels lod_step picks from
+#define LOD_MIN_STEP 4
+#define LOD_MAX_STEP 128
 
 void scanline_convert( struct matrix *points, int i, screen s, zbuffer zb, color c );
+void draw_triangle( struct matrix *polygons, int i, screen s, zbuffer zb, color c );
 
 //polygon organization
 void add_polygon( struct matrix * points,
                    double x0, double y0, double z0,
                    double x1, double y1, double z1,
                    double x2, double y2, double z2);
-void draw_polygons( struct matrix * points, screen s, zbuffer zb,
+void draw_polygons( struct matrix * points, struct normals *normals,
+                    screen s, zbuffer zb,
                     double *view, struct light **lights, int num_lights, color ambient,
                     double *areflect, double *dreflect, double *sreflect);
+void add_triangle( struct triangles *tris, int p0, int p1, int p2 );
+void draw_triangles( struct matrix *points, struct triangles *tris,
+                     struct normals *normals, screen s, zbuffer zb,
+                     double *view, struct light **lights, int num_lights, color ambient,
+                     double *areflect, double *dreflect, double *sreflect);
 
 //3d shapes
 void add_box( struct matrix * edges,
               double x, double y, double z,
               double width, double height, double depth );
-void add_sphere( struct matrix * edges,
+void add_sphere( struct matrix * points, struct triangles *tris,
+                 struct matrix *instance,
                  double cx, double cy, double cz,
                  double r, int step );
 struct matrix * generate_sphere(double cx, double cy, double cz,
                                 double r, int step );
-void add_torus( struct matrix * edges,
+void add_torus( struct matrix * points, struct triangles *tris,
+                struct matrix *instance,
                 double cx, double cy, double cz,
                 double r1, double r2, int step );
 struct matrix * generate_torus( double cx, double cy, double cz,
                                 double r1, double r2, int step );
+void free_shape_cache();
+int lod_step( struct matrix *m, double r, double tolerance, int step );
 
 //advanced shapes
 void add_circle( struct matrix * edges,
@@ -48,6 +70,9 @@ void add_edge( struct matrix * points,
                double x0, double y0, double z0,
                double x1, double y1, double z1);
 void draw_lines( struct matrix * points, screen s, zbuffer zb, color c);
+void draw_edge( double x0, double y0, double z0,
+                double x1, double y1, double z1,
+                screen s, zbuffer zb, color c);
 void draw_line(int x0, int y0, double z0,
                int x1, int y1, double z1,
                screen s, zbuffer zb, color c);
@@ -0,0 +1,622 @@
+/*====================== gif.c ========================
+Animated GIF writer.
+
+Frames are added, in order, as soon as they are drawn (see
+output.c), so the GIF is finished when the last frame is,
+without saving every frame and reading them all back through
+convert.
+
+Each frame is cut down to the rectangle that changed since the
+last one. Pixels in it that did not change are transparent, and
+everything else keeps showing the frame before (disposal method
+1), which leaves long runs for the LZW coder.
+
+Colors are taken as they are when the changed pixels have no
+more than 255 of them. Otherwise a median cut over a 5:5:5
+histogram picks 255, optionally with a 4x4 ordered dither. The
+palette is built for every frame (GIF_LOCAL), or once from the
+first frame and shared by all of them (GIF_GLOBAL).
+==================================================*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ml6.h"
+#include "gif.h"
+
+//pixels sharing the top 5 bits of each channel
+struct gif_bin {
+  long count;
+  long red, green, blue;
+};
+
+//a range of the sorted bins that becomes one palette color
+struct gif_box {
+  int lo, hi;
+  long count;
+  int axis, range;
+};
+
+static const int bayer[4][4] = { { 0,  8,  2, 10},
+                                 {12,  4, 14,  6},
+                                 { 3, 11,  1,  9},
+                                 {15,  7, 13,  5} };
+
+static void put_u16( FILE *f, int v ) {
+  fputc(v & 0xff, f);
+  fputc((v >> 8) & 0xff, f);
+}
+
+static int same_pixel( pixel *a, pixel *b ) {
+  return a->red == b->red && a->green == b->green && a->blue == b->blue;
+}
+
+static int bin_of( int r, int g, int b ) {
+  return (r >> 3) << 10 | (g >> 3) << 5 | b >> 3;
+}
+
+static int clamp_channel( int v ) {
+  return v < 0 ? 0 : v > 255 ? 255 : v;
+}
+
+static int bin_channel( int bin, int axis ) {
+  return (bin >> (10 - 5 * axis)) & 31;
+}
+
+static int cmp_red( const void *a, const void *b ) {
+  return *(int *)a - *(int *)b;
+}
+
+static int cmp_green( const void *a, const void *b ) {
+  int x = *(int *)a, y = *(int *)b;
+  int d = bin_channel(x, 1) - bin_channel(y, 1);
+  return d ? d : x - y;
+}
+
+static int cmp_blue( const void *a, const void *b ) {
+  int x = *(int *)a, y = *(int *)b;
+  int d = bin_channel(x, 2) - bin_channel(y, 2);
+  return d ? d : x - y;
+}
+
+static int (*cmp_axis[3])( const void *, const void * ) =
+  { cmp_red, cmp_green, cmp_blue };
+
+/*======== static int exact_slot() ==========
+Inputs:   struct gif_palette *p
+          int r
+          int g
+          int b
+Returns: The slot of r, g, b in the exact color table of p,
+         or the empty slot where it would go
+====================*/
+static int exact_slot( struct gif_palette *p, int r, int g, int b ) {
+
+  unsigned int key = 1u << 24 | r << 16 | g << 8 | b;
+  int h = (key * 2654435761u) >> 23;
+
+  while ( p->keys[h] && p->keys[h] != key )
+    h = (h + 1) & 511;
+  return h;
+}
+
+/*======== static int add_exact() ==========
+Inputs:   struct gif_palette *p
+          pixel *px
+Returns: 0 if px is a new color and p is already full, 1 otherwise
+
+Adds the color of px to p if it is not there yet
+====================*/
+static int add_exact( struct gif_palette *p, pixel *px ) {
+
+  int h = exact_slot(p, px->red, px->green, px->blue);
+
+  if ( p->keys[h] )
+    return 1;
+  if ( p->size == 255 )
+    return 0;
+  p->keys[h] = 1u << 24 | px->red << 16 | px->green << 8 | px->blue;
+  p->values[h] = p->size;
+  p->rgb[p->size][0] = px->red;
+  p->rgb[p->size][1] = px->green;
+  p->rgb[p->size][2] = px->blue;
+  p->size++;
+  return 1;
+}
+
+/*======== static void measure_box() ==========
+Inputs:   struct gif_box *box
+          int *bins
+          struct gif_bin *hist
+Returns:
+
+Sets the pixel count of box and its longest axis and the
+range of bins along it
+====================*/
+static void measure_box( struct gif_box *box, int *bins, struct gif_bin *hist ) {
+
+  int lo[3] = {31, 31, 31}, hi[3] = {0, 0, 0};
+  int k, a, v;
+
+  box->count = 0;
+  for (k = box->lo; k < box->hi; k++) {
+    box->count += hist[bins[k]].count;
+    for (a = 0; a < 3; a++) {
+      v = bin_channel(bins[k], a);
+      lo[a] = v < lo[a] ? v : lo[a];
+      hi[a] = v > hi[a] ? v : hi[a];
+    }
+  }
+  box->axis = 0;
+  for (a = 1; a < 3; a++)
+    if ( hi[a] - lo[a] > hi[box->axis] - lo[box->axis] )
+      box->axis = a;
+  box->range = hi[box->axis] - lo[box->axis];
+}
+
+/*======== static void median_cut() ==========
+Inputs:   struct gif_palette *p
+          struct gif_bin *hist
+Returns:
+
+Splits the bins used in hist into at most 255 boxes and makes
+their average colors the palette. The box split next is the
+one with the most pixels times the widest range, cut where
+half of its pixels lie on either side.
+====================*/
+static void median_cut( struct gif_palette *p, struct gif_bin *hist ) {
+
+  struct gif_box boxes[255];
+  int *bins;
+  int num_bins, num_boxes, best, k, m;
+  long score, best_score, half, sum;
+
+  bins = (int *)malloc(GIF_BINS * sizeof(int));
+  num_bins = 0;
+  for (k = 0; k < GIF_BINS; k++)
+    if ( hist[k].count )
+      bins[num_bins++] = k;
+
+  boxes[0].lo = 0;
+  boxes[0].hi = num_bins;
+  measure_box(boxes, bins, hist);
+  num_boxes = 1;
+  while ( num_boxes < 255 ) {
+    best = -1;
+    best_score = 0;
+    for (k = 0; k < num_boxes; k++) {
+      score = boxes[k].count * boxes[k].range;
+      if ( boxes[k].hi - boxes[k].lo > 1 && score > best_score ) {
+        best = k;
+        best_score = score;
+      }
+    }
+    if ( best < 0 )
+      break;
+
+    qsort(bins + boxes[best].lo, boxes[best].hi - boxes[best].lo,
+          sizeof(int), cmp_axis[boxes[best].axis]);
+    half = boxes[best].count / 2;
+    sum = 0;
+    for (m = boxes[best].lo; m < boxes[best].hi - 2; m++) {
+      sum += hist[bins[m]].count;
+      if ( sum >= half )
+        break;
+    }
+    boxes[num_boxes].lo = m + 1;
+    boxes[num_boxes].hi = boxes[best].hi;
+    boxes[best].hi = m + 1;
+    measure_box(boxes + best, bins, hist);
+    measure_box(boxes + num_boxes, bins, hist);
+    num_boxes++;
+  }
+
+  for (k = 0; k < num_boxes; k++) {
+    long r = 0, g = 0, b = 0, n = boxes[k].count;
+    for (m = boxes[k].lo; m < boxes[k].hi; m++) {
+      r += hist[bins[m]].red;
+      g += hist[bins[m]].green;
+      b += hist[bins[m]].blue;
+    }
+    p->rgb[k][0] = (r + n / 2) / n;
+    p->rgb[k][1] = (g + n / 2) / n;
+    p->rgb[k][2] = (b + n / 2) / n;
+  }
+  p->size = num_boxes;
+  free(bins);
+}
+
+/*======== static void build_palette() ==========
+Inputs:   struct gif_palette *p
+          pixel *pixels
+          int width
+          int x0
+          int y0
+          int x1
+          int y1
+          pixel *prev
+Returns:
+
+Makes p the palette for the pixels of the width wide image
+in [x0, x1) x [y0, y1), leaving out those that are the same
+in prev when prev is not NULL
+====================*/
+static void build_palette( struct gif_palette *p, pixel *pixels, int width,
+                           int x0, int y0, int x1, int y1, pixel *prev ) {
+
+  struct gif_bin *hist, *h;
+  pixel *px;
+  int x, y;
+
+  p->size = 0;
+  p->exact = 1;
+  memset(p->keys, 0, sizeof(p->keys));
+  memset(p->map, 0xff, sizeof(p->map));
+  hist = (struct gif_bin *)calloc(GIF_BINS, sizeof(struct gif_bin));
+
+  for (y = y0; y < y1; y++)
+    for (x = x0; x < x1; x++) {
+      px = pixels + y * width + x;
+      if ( prev && same_pixel(px, prev + y * width + x) )
+        continue;
+      h = hist + bin_of(px->red, px->green, px->blue);
+      h->count++;
+      h->red += px->red;
+      h->green += px->green;
+      h->blue += px->blue;
+      if ( p->exact && !add_exact(p, px) )
+        p->exact = 0;
+    }
+
+  if ( !p->exact ) {
+    memset(p->keys, 0, sizeof(p->keys));
+    median_cut(p, hist);
+  }
+  free(hist);
+}
+
+/*======== static int palette_index() ==========
+Inputs:   struct gif_palette *p
+          int r
+          int g
+          int b
+Returns: The index of the color of p closest to r, g, b
+====================*/
+static int palette_index( struct gif_palette *p, int r, int g, int b ) {
+
+  int bin, h, k, d, dr, dg, db, best, best_d;
+
+  if ( p->exact ) {
+    h = exact_slot(p, r, g, b);
+    if ( p->keys[h] )
+      return p->values[h];
+  }
+
+  bin = bin_of(r, g, b);
+  if ( p->map[bin] < 0 ) {
+    r = (r & ~7) + 4;
+    g = (g & ~7) + 4;
+    b = (b & ~7) + 4;
+    best = 0;
+    best_d = 1 << 30;
+    for (k = 0; k < p->size; k++) {
+      dr = p->rgb[k][0] - r;
+      dg = p->rgb[k][1] - g;
+      db = p->rgb[k][2] - b;
+      d = dr * dr + dg * dg + db * db;
+      if ( d < best_d ) {
+        best = k;
+        best_d = d;
+      }
+    }
+    p->map[bin] = best;
+  }
+  return p->map[bin];
+}
+
+static int table_bits( struct gif_palette *p ) {
+
+  int bits = 1;
+
+  //one more entry for the transparent index
+  while ( (1 << bits) < p->size + 1 )
+    bits++;
+  return bits;
+}
+
+static void write_table( FILE *f, struct gif_palette *p, int bits ) {
+
+  int k;
+
+  fwrite(p->rgb, 3, p->size, f);
+  for (k = p->size; k < 1 << bits; k++) {
+    fputc(0, f);
+    fputc(0, f);
+    fputc(0, f);
+  }
+}
+
+/*======== static size_t lzw_encode() ==========
+Inputs:   struct gif_writer *g
+          int n
+          int min_size
+Returns: The number of bytes written to g->codes
+
+Compresses the first n of g->indices with variable length
+LZW codes of min_size + 1 to 12 bits, packed low bit first.
+The table starts over with a clear code once it is full.
+====================*/
+static size_t lzw_encode( struct gif_writer *g, int n, int min_size ) {
+
+  unsigned char *out = g->codes;
+  unsigned long bits = 0;
+  int num_bits = 0;
+  int clear = 1 << min_size;
+  int size = min_size + 1, next = clear + 2;
+  int prefix, key, h, k;
+
+#define PUT_CODE(c) do {                        \
+    bits |= (unsigned long)(c) << num_bits;     \
+    num_bits += size;                           \
+    while ( num_bits >= 8 ) {                   \
+      *out++ = bits & 0xff;                     \
+      bits >>= 8;                               \
+      num_bits -= 8;                            \
+    }                                           \
+  } while (0)
+
+  memset(g->keys, 0xff, sizeof(g->keys));
+  PUT_CODE(clear);
+  prefix = g->indices[0];
+  for (k = 1; k < n; k++) {
+    key = prefix << 8 | g->indices[k];
+    h = ((unsigned int)key * 2654435761u) >> 19;
+    while ( g->keys[h] >= 0 && g->keys[h] != key )
+      h = (h + 1) & (GIF_HASH_SIZE - 1);
+    if ( g->keys[h] == key ) {
+      prefix = g->values[h];
+      continue;
+    }
+
+    PUT_CODE(prefix);
+    g->keys[h] = key;
+    g->values[h] = next;
+    //the decoder adds this string one code later, so the
+    //next code is the first one that may need the extra bit
+    if ( next >= 1 << size )
+      size++;
+    if ( next == GIF_MAX_CODES - 1 ) {
+      PUT_CODE(clear);
+      memset(g->keys, 0xff, sizeof(g->keys));
+      size = min_size + 1;
+      next = clear + 2;
+    }
+    else
+      next++;
+    prefix = g->indices[k];
+  }
+  PUT_CODE(prefix);
+  //reading prefix makes the decoder add a string of its own
+  if ( next > clear + 2 && next == 1 << size && size < 12 )
+    size++;
+  PUT_CODE(clear + 1);
+  if ( num_bits )
+    *out++ = bits & 0xff;
+#undef PUT_CODE
+
+  return out - g->codes;
+}
+
+/*======== static void write_header() ==========
+Inputs:   struct gif_writer *g
+Returns:
+
+Writes the screen descriptor, with the palette of g as the
+global color table in GIF_GLOBAL mode, and asks for the
+animation to loop forever
+====================*/
+static void write_header( struct gif_writer *g ) {
+
+  FILE *f = g->f;
+  int bits;
+
+  fwrite("GIF89a", 1, 6, f);
+  put_u16(f, g->width);
+  put_u16(f, g->height);
+  if ( g->palette_mode == GIF_GLOBAL && g->palette.size ) {
+    bits = table_bits(&g->palette);
+    fputc(0xf0 | (bits - 1), f);
+    fputc(0, f);
+    fputc(0, f);
+    write_table(f, &g->palette, bits);
+  }
+  else {
+    fputc(0x70, f);
+    fputc(0, f);
+    fputc(0, f);
+  }
+
+  fputc(0x21, f);
+  fputc(0xff, f);
+  fputc(11, f);
+  fwrite("NETSCAPE2.0", 1, 11, f);
+  fputc(3, f);
+  fputc(1, f);
+  put_u16(f, 0);
+  fputc(0, f);
+}
+
+/*======== static void encode_frame() ==========
+Inputs:   struct gif_writer *g
+          pixel *pixels
+Returns:
+
+Appends pixels to the file as the next frame
+====================*/
+static void encode_frame( struct gif_writer *g, pixel *pixels ) {
+
+  struct gif_palette *p = &g->palette;
+  pixel *prev = g->prev;
+  pixel *px;
+  unsigned char *idx;
+  int x0, y0, x1, y1, x, y, l, r, d;
+  int transparent, bits, min_size;
+  size_t len, k;
+
+  x0 = y0 = 0;
+  x1 = g->width;
+  y1 = g->height;
+  if ( prev ) {
+    x0 = g->width;
+    y0 = g->height;
+    x1 = y1 = 0;
+    for (y = 0; y < g->height; y++) {
+      px = pixels + y * g->width;
+      for (l = 0; l < g->width && same_pixel(px + l, prev + (px + l - pixels)); l++);
+      if ( l == g->width )
+        continue;
+      for (r = g->width - 1; same_pixel(px + r, prev + (px + r - pixels)); r--);
+      x0 = l < x0 ? l : x0;
+      x1 = r + 1 > x1 ? r + 1 : x1;
+      y0 = y < y0 ? y : y0;
+      y1 = y + 1;
+    }
+    //nothing changed, show the last frame a little longer
+    if ( x0 >= x1 ) {
+      x0 = y0 = 0;
+      x1 = y1 = 1;
+    }
+  }
+
+  if ( g->palette_mode == GIF_LOCAL )
+    build_palette(p, pixels, g->width, x0, y0, x1, y1, prev);
+  else if ( !prev )
+    build_palette(p, pixels, g->width, 0, 0, g->width, g->height, NULL);
+  if ( !prev )
+    write_header(g);
+
+  transparent = p->size;
+  bits = table_bits(p);
+  idx = g->indices;
+  for (y = y0; y < y1; y++)
+    for (x = x0; x < x1; x++) {
+      px = pixels + y * g->width + x;
+      if ( prev && same_pixel(px, prev + y * g->width + x) )
+        *idx++ = transparent;
+      else if ( g->dither && !p->exact ) {
+        d = bayer[y & 3][x & 3] - 8;
+        *idx++ = palette_index(p, clamp_channel(px->red + d),
+                               clamp_channel(px->green + d),
+                               clamp_channel(px->blue + d));
+      }
+      else
+        *idx++ = palette_index(p, px->red, px->green, px->blue);
+    }
+
+  //graphic control: keep the last frame under this one,
+  //delay in 1/100s, transparent index
+  fputc(0x21, g->f);
+  fputc(0xf9, g->f);
+  fputc(4, g->f);
+  fputc(1 << 2 | (prev != NULL), g->f);
+  put_u16(g->f, g->delay);
+  fputc(transparent, g->f);
+  fputc(0, g->f);
+
+  fputc(0x2c, g->f);
+  put_u16(g->f, x0);
+  put_u16(g->f, y0);
+  put_u16(g->f, x1 - x0);
+  put_u16(g->f, y1 - y0);
+  if ( g->palette_mode == GIF_LOCAL ) {
+    fputc(0x80 | (bits - 1), g->f);
+    write_table(g->f, p, bits);
+  }
+  else
+    fputc(0, g->f);
+
+  min_size = bits < 2 ? 2 : bits;
+  len = lzw_encode(g, (x1 - x0) * (y1 - y0), min_size);
+  fputc(min_size, g->f);
+  for (k = 0; k < len; k += 255) {
+    fputc(len - k < 255 ? len - k : 255, g->f);
+    fwrite(g->codes + k, 1, len - k < 255 ? len - k : 255, g->f);
+  }
+  fputc(0, g->f);
+
+  if ( !prev )
+    g->prev = (pixel *)malloc(g->width * g->height * sizeof(pixel));
+  memcpy(g->prev, pixels, g->width * g->height * sizeof(pixel));
+}
+
+/*======== struct gif_writer *new_gif() ==========
+Inputs:   char *file
+          int width
+          int height
+          int delay
+          int palette_mode
+          int dither
+Returns: A writer for a width x height GIF animation in file,
+         showing each frame for delay hundredths of a second,
+         or NULL if file could not be opened
+
+palette_mode is GIF_LOCAL or GIF_GLOBAL. When dither is set,
+images with more than 255 colors are dithered.
+====================*/
+struct gif_writer *new_gif( char *file, int width, int height, int delay,
+                            int palette_mode, int dither ) {
+
+  struct gif_writer *g;
+  FILE *f;
+
+  f = fopen(file, "wb");
+  if ( !f )
+    return NULL;
+  g = (struct gif_writer *)calloc(1, sizeof(struct gif_writer));
+  g->f = f;
+  g->width = width;
+  g->height = height;
+  g->delay = delay;
+  g->palette_mode = palette_mode;
+  g->dither = dither;
+  g->indices = (unsigned char *)malloc((size_t)width * height);
+  //at most one 12 bit code per pixel, plus the clear codes
+  g->codes = (unsigned char *)malloc((size_t)width * height * 2 + 64);
+  return g;
+}
+
+/*======== void add_gif_frame() ==========
+Inputs:   struct gif_writer *g
+          screen s
+Returns:
+
+Adds s to g as the next frame
+====================*/
+void add_gif_frame( struct gif_writer *g, screen s ) {
+  encode_frame(g, s->pixels);
+}
+
+/*======== int close_gif() ==========
+Inputs:   struct gif_writer *g
+Returns: 0 on success, -1 if the file could not be written
+
+Ends the file and frees g
+====================*/
+int close_gif( struct gif_writer *g ) {
+
+  int err;
+
+  if ( !g->prev )
+    write_header(g);
+  fputc(0x3b, g->f);
+
+  err = ferror(g->f);
+  if ( fclose(g->f) )
+    err = 1;
+  free(g->prev);
+  free(g->indices);
+  free(g->codes);
+  free(g);
+  return err ? -1 : 0;
+}
@@ -0,0 +1,60 @@
+#ifndef GIF_H
+#define GIF_H
+
+#include <stdio.h>
+
+#include "ml6.h"
+
+//pixels are looked up in the palette by their top 5 bits
+//of red, green and blue
+#define GIF_BINS 32768
+
+//LZW codes are at most 12 bits
+#define GIF_MAX_CODES 4096
+
+//open addressed table of the LZW strings seen so far
+#define GIF_HASH_SIZE 8192
+
+//palette modes
+#define GIF_LOCAL 0
+#define GIF_GLOBAL 1
+
+/*
+  Up to 255 colors; index size is left for transparent pixels.
+  When the image had no more colors than that they are stored
+  exactly and found through keys/values, otherwise map caches
+  the nearest color of each 5:5:5 bin (-1 until needed).
+*/
+struct gif_palette {
+  int size;
+  int exact;
+  unsigned char rgb[256][3];
+  unsigned int keys[512];
+  unsigned char values[512];
+  short map[GIF_BINS];
+};
+
+/*
+  An animated GIF written as its frames finish, each one only
+  where it differs from the last.
+*/
+struct gif_writer {
+  FILE *f;
+  int width, height;
+  int delay;
+  int palette_mode;
+  int dither;
+  pixel *prev;
+  struct gif_palette palette;
+  unsigned char *indices;
+  unsigned char *codes;
+  int keys[GIF_HASH_SIZE];
+  short values[GIF_HASH_SIZE];
+};
+
+struct gif_writer *new_gif( char *file, int width, int height, int delay,
+                            int palette_mode, int dither );
+void add_gif_frame( struct gif_writer *g, screen s );
+int close_gif( struct gif_writer *g );
+
+#endif
@@ -2,6 +2,10 @@
 #include <stdlib.h>
 #include <math.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include "gmath.h"
 #include "matrix.h"
 #include "ml6.h"
@@ -126,23 +130,222 @@ double dot_product( double *a, double *b ) {
   return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
 }
 
-double *calculate_normal(struct matrix *polygons, int i) {
+/*======== void grow_normals() ==========
+Inputs:   struct normals *n
+          int count
+Returns:
+
+Makes room in n for count normals and sets n->count.
+Memory is only ever added, so a buffer that is reused
+every frame stops allocating after the first one.
+====================*/
+void grow_normals( struct normals *n, int count ) {
+
+  if ( count > n->size ) {
+    n->size = count;
+    n->x = (double *)realloc(n->x, count * sizeof(double));
+    n->y = (double *)realloc(n->y, count * sizeof(double));
+    n->z = (double *)realloc(n->z, count * sizeof(double));
+    n->front = (int *)realloc(n->front, count * sizeof(int));
+    if ( !n->x || !n->y || !n->z || !n->front ) {
+      printf("error: could not allocate %d normals\n", count);
+      exit(1);
+    }
+  }
+  n->count = count;
+}
+
+/*======== void free_normals() ==========
+Inputs:   struct normals *n
+Returns:
+
+Frees the arrays of n and leaves it empty
+====================*/
+void free_normals( struct normals *n ) {
+
+  free(n->x);
+  free(n->y);
+  free(n->z);
+  free(n->front);
+  n->x = n->y = n->z = NULL;
+  n->front = NULL;
+  n->count = n->size = 0;
+}
+
+/*======== void calculate_normals() ==========
+Inputs:   struct matrix *polygons
+          struct normals *n
+Returns:
+
+Fills n with the (unnormalized) surface normal of every
+triangle in polygons, AB x AC for triangle ABC
+====================*/
+void calculate_normals( struct matrix *polygons, struct normals *n ) {
+
+  double *x = polygons->m[0];
+  double *y = polygons->m[1];
+  double *z = polygons->m[2];
+  double ax, ay, az, bx, by, bz;
+  int t, i;
+
+  grow_normals(n, polygons->lastcol / 3);
+  for (t = 0; t < n->count; t++) {
+    i = t * 3;
+    ax = x[i+1] - x[i];
+    ay = y[i+1] - y[i];
+    az = z[i+1] - z[i];
+    bx = x[i+2] - x[i];
+    by = y[i+2] - y[i];
+    bz = z[i+2] - z[i];
+    n->x[t] = ay * bz - az * by;
+    n->y[t] = az * bx - ax * bz;
+    n->z[t] = ax * by - ay * bx;
+  }
+}
 
-  double A[3];
-  double B[3];
-  double *N = (double *)malloc(3 * sizeof(double));
+/*======== void calculate_indexed_normals() ==========
+Inputs:   struct matrix *points
+          struct triangles *tris
+          struct normals *n
+Returns:
+
+Fills n with the (unnormalized) surface normal of every
+triangle in tris, worked out exactly as calculate_normals
+would from a copy of its three points
+====================*/
+void calculate_indexed_normals( struct matrix *points, struct triangles *tris,
+                                struct normals *n ) {
+
+  double *x = points->m[0];
+  double *y = points->m[1];
+  double *z = points->m[2];
+  double ax, ay, az, bx, by, bz;
+  int t, *v;
+
+  grow_normals(n, tris->count);
+  for (t = 0; t < n->count; t++) {
+    v = tris->v + t * 3;
+    ax = x[v[1]] - x[v[0]];
+    ay = y[v[1]] - y[v[0]];
+    az = z[v[1]] - z[v[0]];
+    bx = x[v[2]] - x[v[0]];
+    by = y[v[2]] - y[v[0]];
+    bz = z[v[2]] - z[v[0]];
+    n->x[t] = ay * bz - az * by;
+    n->y[t] = az * bx - ax * bz;
+    n->z[t] = ax * by - ay * bx;
+  }
+}
 
-  A[0] = polygons->m[0][i+1] - polygons->m[0][i];
-  A[1] = polygons->m[1][i+1] - polygons->m[1][i];
-  A[2] = polygons->m[2][i+1] - polygons->m[2][i];
+/*======== void transform_normals() ==========
+Inputs:   struct matrix *m
+          struct normals *n
+Returns:
+
+Turns the normals of some triangles into the normals of
+those triangles after they have been multiplied by m.
+
+For a 3x3 matrix L, (La) x (Lb) = cof(L)(a x b), where cof(L)
+is the matrix of cofactors of L. Multiplying by it rather than
+the inverse transpose keeps the length and direction the
+normals would have if they were worked out again from the
+transformed points, mirrored transforms included.
+====================*/
+void transform_normals( struct matrix *m, struct normals *n ) {
+
+  double **l = m->m;
+  double c[3][3];
+  double x, y, z;
+  int t;
+
+  c[0][0] = l[1][1] * l[2][2] - l[1][2] * l[2][1];
+  c[0][1] = l[1][2] * l[2][0] - l[1][0] * l[2][2];
+  c[0][2] = l[1][0] * l[2][1] - l[1][1] * l[2][0];
+  c[1][0] = l[0][2] * l[2][1] - l[0][1] * l[2][2];
+  c[1][1] = l[0][0] * l[2][2] - l[0][2] * l[2][0];
+  c[1][2] = l[0][1] * l[2][0] - l[0][0] * l[2][1];
+  c[2][0] = l[0][1] * l[1][2] - l[0][2] * l[1][1];
+  c[2][1] = l[0][2] * l[1][0] - l[0][0] * l[1][2];
+  c[2][2] = l[0][0] * l[1][1] - l[0][1] * l[1][0];
+
+  for (t = 0; t < n->count; t++) {
+    x = n->x[t];
+    y = n->y[t];
+    z = n->z[t];
+    n->x[t] = c[0][0] * x + c[0][1] * y + c[0][2] * z;
+    n->y[t] = c[1][0] * x + c[1][1] * y + c[1][2] * z;
+    n->z[t] = c[2][0] * x + c[2][1] * y + c[2][2] * z;
+  }
+}
+
+/*======== int find_front_faces() ==========
+Inputs:   struct normals *n
+          double *view
+Returns: The number of triangles facing view
+
+Lists the triangles whose normal has a positive dot product
+with view in n->front, in order. Two triangles are tested per
+step with SSE2, the dot products summed in the same order as
+dot_product so the result does not depend on the path taken.
+====================*/
+int find_front_faces( struct normals *n, double *view ) {
+
+  int t = 0, count = 0;
+
+#ifdef __SSE2__
+  __m128d vx = _mm_set1_pd(view[0]);
+  __m128d vy = _mm_set1_pd(view[1]);
+  __m128d vz = _mm_set1_pd(view[2]);
+  __m128d dot;
+  int bits;
+
+  for (; t + 2 <= n->count; t += 2) {
+    dot = _mm_add_pd(_mm_mul_pd(_mm_loadu_pd(n->x + t), vx),
+                     _mm_mul_pd(_mm_loadu_pd(n->y + t), vy));
+    dot = _mm_add_pd(dot, _mm_mul_pd(_mm_loadu_pd(n->z + t), vz));
+    bits = _mm_movemask_pd(_mm_cmpgt_pd(dot, _mm_setzero_pd()));
+    n->front[count] = t;
+    count += bits & 1;
+    n->front[count] = t + 1;
+    count += bits >> 1;
+  }
+#endif
+  for (; t < n->count; t++) {
+    n->front[count] = t;
+    count += n->x[t] * view[0] + n->y[t] * view[1] + n->z[t] * view[2] > 0;
+  }
+  return count;
+}
+
+/*======== void grow_triangles() ==========
+Inputs:   struct triangles *t
+          int count
+Returns:
+
+Makes room in t for count triangles, keeping the ones it
+has. Like grow_normals, memory is only ever added.
+====================*/
+void grow_triangles( struct triangles *t, int count ) {
+
+  if ( count > t->size ) {
+    t->size = count > 2 * t->size ? count : 2 * t->size;
+    t->v = (int *)realloc(t->v, 3 * (size_t)t->size * sizeof(int));
+    if ( !t->v ) {
+      printf("error: could not allocate %d triangles\n", count);
+      exit(1);
+    }
+  }
+}
 
-  B[0] = polygons->m[0][i+2] - polygons->m[0][i];
-  B[1] = polygons->m[1][i+2] - polygons->m[1][i];
-  B[2] = polygons->m[2][i+2] - polygons->m[2][i];
+/*======== void free_triangles() ==========
+Inputs:   struct triangles *t
+Returns:
 
-  N[0] = A[1] * B[2] - A[2] * B[1];
-  N[1] = A[2] * B[0] - A[0] * B[2];
-  N[2] = A[0] * B[1] - A[1] * B[0];
+Frees the indices of t and leaves it empty
+====================*/
+void free_triangles( struct triangles *t ) {
 
-  return N;
+  free(t->v);
+  t->v = NULL;
+  t->count = t->size = 0;
 }
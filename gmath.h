@@ -15,6 +15,29 @@
 #define BLUE 2
 #define SPECULAR_EXP 4
 
+/*
+  The normals of the triangles of a polygon matrix, stored as
+  separate x, y and z arrays so that they can be worked on a
+  few at a time. front lists the triangles find_front_faces
+  kept. Buffers grow as needed and are meant to be reused.
+*/
+struct normals {
+  int count, size;
+  double *x, *y, *z;
+  int *front;
+};
+
+/*
+  Triangles given as three column numbers each in to a point
+  matrix, so that a point shared by several triangles is only
+  stored and transformed once. Grows as needed and is meant to
+  be reused.
+*/
+struct triangles {
+  int count, size;
+  int *v;
+};
+
 //lighting functions
 color get_lighting( double *normal, double *view, color alight, struct light **lights, int num_lights, double *areflect, double *dreflect, double *sreflect);
 color calculate_ambient(color alight, double *areflect );
@@ -25,6 +48,18 @@ void limit_color( color * c );
 //vector functions
 void normalize( double *vector );
 double dot_product( double *a, double *b );
-double *calculate_normal(struct matrix *polygons, int i);
+
+//batched normals
+void grow_normals( struct normals *n, int count );
+void free_normals( struct normals *n );
+void calculate_normals( struct matrix *polygons, struct normals *n );
+void calculate_indexed_normals( struct matrix *points, struct triangles *tris,
+                                struct normals *n );
+void transform_normals( struct matrix *m, struct normals *n );
+int find_front_faces( struct normals *n, double *view );
+
+//index buffers
+void grow_triangles( struct triangles *t, int count );
+void free_triangles( struct triangles *t );
 
 #endif
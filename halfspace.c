@@ -0,0 +1,329 @@
+/*====================== halfspace.c ========================
+Half-space (edge function) triangle fill, the default rasterizer
+(scanline_convert is kept behind --rasterizer scanline).
+
+Vertices are snapped to a grid of 1/SUBPIXEL pixels, and each
+edge of the triangle becomes a function
+E(x, y) = A*x + B*y + C that is >= 0 on the inside of the edge,
+with A, B and C integers on that grid. Every pixel of the
+triangle's bounding box whose center is inside all three edges
+is z tested against the plane through the vertices and written.
+
+The edge functions are exact, so two triangles sharing an edge
+agree on which side of it every pixel center lies. A center
+exactly on a shared edge goes to the triangle for which it is
+a top or left edge (see edge_bias) and never to both, so meshes
+come out without cracks or double writes and do not need their
+outlines drawn over them.
+
+Rows are done 8 pixels at a time with AVX2 when the CPU has it
+and SSE4.1 otherwise. The edge values are integers carried in
+doubles; they stay below 2^53 for anything inside the guard
+band, so every path computes exactly the same image.
+==================================================*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HALFSPACE_X86
+#endif
+
+#include "ml6.h"
+#include "matrix.h"
+#include "halfspace.h"
+#include "hiz.h"
+
+/*
+  The edge functions and depth along one row, so that for the
+  pixel whose center is at x + 0.5: E_k = a[k] * x + b[k] and
+  z = zx * x + zr. The top-left bias is folded in to b[k], and
+  the pixel is inside when every E_k >= 0.
+*/
+struct hs_row {
+    double a[3];
+    double b[3];
+    double zx, zr;
+};
+
+typedef void (*hs_span_fn)( struct hs_row *r, double *zrow, pixel *prow,
+                            int x, int xend, color c );
+
+/*======== static void span_scalar() ==========
+  Inputs:   struct hs_row *r
+  double *zrow
+  pixel *prow
+  int x
+  int xend
+  color c
+  Returns:
+
+  Fills pixels x through xend-1 of a row one at a time.
+  The depth is rounded the same way plot rounds it.
+  ====================*/
+static void span_scalar( struct hs_row *r, double *zrow, pixel *prow,
+                         int x, int xend, color c ) {
+
+    double z;
+
+    for (; x < xend; x++) {
+        if ( r->a[0] * x + r->b[0] >= 0 &&
+             r->a[1] * x + r->b[1] >= 0 &&
+             r->a[2] * x + r->b[2] >= 0 ) {
+            z = round_depth(r->zx * x + r->zr);
+            if ( zrow[x] <= z ) {
+                zrow[x] = z;
+                prow[x].red = c.red;
+                prow[x].green = c.green;
+                prow[x].blue = c.blue;
+            }
+        }
+    }
+}
+
+#ifdef HALFSPACE_X86
+
+/*======== static void span_sse41() ==========
+  Same as span_scalar, 8 pixels per step as four pairs.
+  The z test result is blended back into the zbuffer.
+  ====================*/
+__attribute__((target("sse4.1")))
+static void span_sse41( struct hs_row *r, double *zrow, pixel *prow,
+                       int x, int xend, color c ) {
+
+    __m128d a0 = _mm_set1_pd(r->a[0]), b0 = _mm_set1_pd(r->b[0]);
+    __m128d a1 = _mm_set1_pd(r->a[1]), b1 = _mm_set1_pd(r->b[1]);
+    __m128d a2 = _mm_set1_pd(r->a[2]), b2 = _mm_set1_pd(r->b[2]);
+    __m128d zx = _mm_set1_pd(r->zx), zr = _mm_set1_pd(r->zr);
+    __m128d zero = _mm_setzero_pd();
+    __m128d scale = _mm_set1_pd(DEPTH_SCALE);
+    __m128d xc, z, zold, pass;
+    int k, lane, bits;
+
+    for (; x + 8 <= xend; x += 8) {
+        for (k = 0; k < 8; k += 2) {
+            xc = _mm_add_pd(_mm_set1_pd((double)(x + k)),
+                            _mm_set_pd(1, 0));
+            pass = _mm_cmpge_pd(_mm_add_pd(_mm_mul_pd(a0, xc), b0), zero);
+            pass = _mm_and_pd(pass, _mm_cmpge_pd(_mm_add_pd(_mm_mul_pd(a1, xc), b1), zero));
+            pass = _mm_and_pd(pass, _mm_cmpge_pd(_mm_add_pd(_mm_mul_pd(a2, xc), b2), zero));
+            if ( !_mm_movemask_pd(pass) )
+                continue;
+
+            //round_depth, as in plot
+            z = _mm_add_pd(_mm_mul_pd(zx, xc), zr);
+            z = _mm_div_pd(_mm_floor_pd(_mm_mul_pd(z, scale)), scale);
+
+            zold = _mm_loadu_pd(zrow + x + k);
+            pass = _mm_and_pd(pass, _mm_cmple_pd(zold, z));
+            bits = _mm_movemask_pd(pass);
+            if ( !bits )
+                continue;
+            _mm_storeu_pd(zrow + x + k, _mm_blendv_pd(zold, z, pass));
+            for (lane = 0; lane < 2; lane++)
+                if ( bits & (1 << lane) ) {
+                    prow[x + k + lane].red = c.red;
+                    prow[x + k + lane].green = c.green;
+                    prow[x + k + lane].blue = c.blue;
+                }
+        }
+    }
+    span_scalar(r, zrow, prow, x, xend, c);
+}
+
+/*======== static void span_avx2() ==========
+  Same as span_scalar, 8 pixels per step as two quads.
+  Depth is written with a masked store, and so are the
+  pixels when they are 32 bits wide (FB_RGBX).
+  ====================*/
+__attribute__((target("avx2")))
+static void span_avx2( struct hs_row *r, double *zrow, pixel *prow,
+                       int x, int xend, color c ) {
+
+    __m256d a0 = _mm256_set1_pd(r->a[0]), b0 = _mm256_set1_pd(r->b[0]);
+    __m256d a1 = _mm256_set1_pd(r->a[1]), b1 = _mm256_set1_pd(r->b[1]);
+    __m256d a2 = _mm256_set1_pd(r->a[2]), b2 = _mm256_set1_pd(r->b[2]);
+    __m256d zx = _mm256_set1_pd(r->zx), zr = _mm256_set1_pd(r->zr);
+    __m256d zero = _mm256_setzero_pd();
+    __m256d scale = _mm256_set1_pd(DEPTH_SCALE);
+    __m256d xc, z, pass;
+    int k, lane, bits;
+#ifdef FB_RGBX
+    __m256i lane_bits = _mm256_set_epi32(128, 64, 32, 16, 8, 4, 2, 1);
+    __m256i fill = _mm256_set1_epi32(c.red | (c.green << 8) | (c.blue << 16));
+    __m256i store;
+#endif
+
+    for (; x + 8 <= xend; x += 8) {
+        bits = 0;
+        for (k = 0; k < 8; k += 4) {
+            xc = _mm256_add_pd(_mm256_set1_pd((double)(x + k)),
+                               _mm256_set_pd(3, 2, 1, 0));
+            pass = _mm256_cmp_pd(_mm256_add_pd(_mm256_mul_pd(a0, xc), b0), zero, _CMP_GE_OQ);
+            pass = _mm256_and_pd(pass, _mm256_cmp_pd(_mm256_add_pd(_mm256_mul_pd(a1, xc), b1), zero, _CMP_GE_OQ));
+            pass = _mm256_and_pd(pass, _mm256_cmp_pd(_mm256_add_pd(_mm256_mul_pd(a2, xc), b2), zero, _CMP_GE_OQ));
+            if ( !_mm256_movemask_pd(pass) )
+                continue;
+
+            //round_depth, as in plot
+            z = _mm256_add_pd(_mm256_mul_pd(zx, xc), zr);
+            z = _mm256_div_pd(_mm256_floor_pd(_mm256_mul_pd(z, scale)), scale);
+
+            pass = _mm256_and_pd(pass, _mm256_cmp_pd(_mm256_loadu_pd(zrow + x + k),
+                                                     z, _CMP_LE_OQ));
+            _mm256_maskstore_pd(zrow + x + k, _mm256_castpd_si256(pass), z);
+            bits |= _mm256_movemask_pd(pass) << k;
+        }
+        if ( !bits )
+            continue;
+#ifdef FB_RGBX
+        store = _mm256_and_si256(_mm256_set1_epi32(bits), lane_bits);
+        store = _mm256_cmpeq_epi32(store, lane_bits);
+        _mm256_maskstore_epi32((int *)(prow + x), store, fill);
+#else
+        for (lane = 0; lane < 8; lane++)
+            if ( bits & (1 << lane) ) {
+                prow[x + lane].red = c.red;
+                prow[x + lane].green = c.green;
+                prow[x + lane].blue = c.blue;
+            }
+#endif
+    }
+    span_scalar(r, zrow, prow, x, xend, c);
+}
+#endif
+
+/*======== static hs_span_fn pick_span() ==========
+  Inputs:
+  Returns: The fastest span filler this CPU can run
+  ====================*/
+static hs_span_fn pick_span() {
+#ifdef HALFSPACE_X86
+    if ( __builtin_cpu_supports("avx2") )
+        return span_avx2;
+    if ( __builtin_cpu_supports("sse4.1") )
+        return span_sse41;
+#endif
+    return span_scalar;
+}
+
+/*======== static int edge_bias() ==========
+  Inputs:   long long a
+  long long b
+  Returns: 0 if the edge E = a*x + b*y + c is a top or left
+  edge of its triangle, -1 otherwise
+
+  The inside of the edge is E >= 0, so its direction is (b, -a).
+  Adding the bias to E moves pixel centers that lie exactly on
+  an edge out of the triangle unless the edge is top or left.
+  The edge shared by two triangles has its a and b negated in
+  the other one, so exactly one of them gets those centers.
+  ====================*/
+static int edge_bias( long long a, long long b ) {
+
+    if ( a > 0 || (a == 0 && b < 0) )
+        return 0;
+    return -1;
+}
+
+/*======== void halfspace_convert() ==========
+  Inputs: struct matrix *points
+  int i
+  screen s
+  zbuffer zb
+  color c
+  Returns:
+
+  Fills in triangle i of points by testing the center of every
+  pixel of its bounding box, within the clip rectangle of s,
+  against its three edge functions.
+  ====================*/
+void halfspace_convert( struct matrix *points, int i, screen s, zbuffer zb, color c ) {
+
+    struct hs_row r;
+    hs_span_fn span = pick_span();
+    long long X[3], Y[3], A[3], B[3], C[3], area;
+    double x[3], y[3], z[3];
+    double zy, zc, yc;
+    double xmin, xmax, ymin, ymax;
+    int k, next, px0, px1, py0, py1, py, row;
+
+    //snap to the subpixel grid; points are inside the guard band
+    for (k = 0; k < 3; k++) {
+        x[k] = points->m[0][i+k];
+        y[k] = points->m[1][i+k];
+        z[k] = points->m[2][i+k];
+        if ( isnan(x[k]) || isnan(y[k]) )
+            return;
+        X[k] = (long long)floor(x[k] * SUBPIXEL + 0.5);
+        Y[k] = (long long)floor(y[k] * SUBPIXEL + 0.5);
+    }
+
+    area = (X[1] - X[0]) * (Y[2] - Y[0]) - (X[2] - X[0]) * (Y[1] - Y[0]);
+    if ( area == 0 )
+        return;
+
+    //E_k(x, y) = (x_k+1 - x_k)(y - y_k) - (y_k+1 - y_k)(x - x_k),
+    //flipped for clockwise triangles so the inside is always >= 0
+    for (k = 0; k < 3; k++) {
+        next = (k + 1) % 3;
+        A[k] = Y[k] - Y[next];
+        B[k] = X[next] - X[k];
+        C[k] = (Y[next] - Y[k]) * X[k] - (X[next] - X[k]) * Y[k];
+        if ( area < 0 ) {
+            A[k] = -A[k];
+            B[k] = -B[k];
+            C[k] = -C[k];
+        }
+        C[k] += edge_bias(A[k], B[k]);
+    }
+
+    //plane through the snapped vertices: z = zx * x + zy * y + zc
+    for (k = 0; k < 3; k++) {
+        x[k] = (double)X[k] / SUBPIXEL;
+        y[k] = (double)Y[k] / SUBPIXEL;
+    }
+    r.zx = ((z[1] - z[0]) * (y[2] - y[0]) - (z[2] - z[0]) * (y[1] - y[0])) /
+        ((double)area / (SUBPIXEL * SUBPIXEL));
+    zy = ((z[2] - z[0]) * (x[1] - x[0]) - (z[1] - z[0]) * (x[2] - x[0])) /
+        ((double)area / (SUBPIXEL * SUBPIXEL));
+    zc = z[0] - r.zx * x[0] - zy * y[0];
+    zc += r.zx * 0.5;
+
+    //pixel x, row y has its center at subpixel
+    //(x * SUBPIXEL + SUBPIXEL/2, y * SUBPIXEL + SUBPIXEL/2)
+    for (k = 0; k < 3; k++)
+        r.a[k] = (double)(A[k] * SUBPIXEL);
+
+    //pixels whose centers fall in the bounding box, clipped
+    xmin = fmin(x[0], fmin(x[1], x[2]));
+    xmax = fmax(x[0], fmax(x[1], x[2]));
+    ymin = fmin(y[0], fmin(y[1], y[2]));
+    ymax = fmax(y[0], fmax(y[1], y[2]));
+    xmin = fmax(ceil(xmin - 0.5), s->clip_x0);
+    xmax = fmin(floor(xmax - 0.5), s->clip_x1 - 1);
+    ymin = fmax(ceil(ymin - 0.5), s->height - s->clip_y1);
+    ymax = fmin(floor(ymax - 0.5), s->height - 1 - s->clip_y0);
+    if ( xmin > xmax || ymin > ymax )
+        return;
+    px0 = xmin;
+    px1 = xmax + 1;
+    py0 = ymin;
+    py1 = ymax;
+
+    for (py = py0; py <= py1; py++) {
+        yc = (double)py + 0.5;
+        for (k = 0; k < 3; k++)
+            r.b[k] = (double)(A[k] * (SUBPIXEL / 2) +
+                              B[k] * (py * SUBPIXEL + SUBPIXEL / 2) + C[k]);
+        r.zr = zy * yc + zc;
+        row = s->height - 1 - py;
+        span(&r, zb->z + row * zb->width, s->pixels + row * s->width,
+             px0, px1, c);
+    }
+    if ( zb->hiz )
+        hiz_mark_rect(zb, px0, px1, s->height - 1 - py1, s->height - py0,
+                      fmax(z[0], fmax(z[1], z[2])));
+}
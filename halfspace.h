@@ -0,0 +1,13 @@
+#ifndef HALFSPACE_H
+#define HALFSPACE_H
+
+#include "matrix.h"
+#include "ml6.h"
+
+//vertices are snapped to 1/SUBPIXEL of a pixel before edge
+//functions are set up; a power of 2 so snapping is exact
+#define SUBPIXEL 256
+
+void halfspace_convert( struct matrix *points, int i, screen s, zbuffer zb, color c );
+
+#endif
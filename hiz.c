@@ -0,0 +1,306 @@
+/*====================== hiz.c ========================
+Hierarchical z-buffer.
+
+Every HIZ_TILE x HIZ_TILE block of a zbuffer keeps the range of
+depths stored in it. A triangle or span whose nearest depth is
+behind the farthest depth of every block it covers cannot pass
+a single z test, so it is thrown away before any per-pixel work.
+A span whose farthest depth is in front of the nearest depth of
+its block passes every z test, so it is written without them.
+
+Depths only ever grow between clears, so a block's farthest
+depth stays a safe lower bound after writes. Blocks are marked
+dirty when written and rescanned only when a test needs a
+tighter bound.
+==================================================*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <math.h>
+
+#include "ml6.h"
+#include "matrix.h"
+#include "hiz.h"
+
+/*======== static double depth_slack() ==========
+Inputs:   double z
+          double range
+Returns: A margin that covers rounding errors when z is
+         stepped across a span of the given depth range
+====================*/
+static double depth_slack( double z, double range ) {
+  return 1e-6 * (1 + fabs(z) + fabs(range));
+}
+
+/*======== void enable_hiz() ==========
+Inputs:   zbuffer zb
+Returns:
+
+Sets up the tiles for zb. They start out empty, so
+clear_zbuffer must still be called before drawing.
+====================*/
+void enable_hiz( zbuffer zb ) {
+
+  struct hiz *h;
+
+  disable_hiz(zb);
+  h = (struct hiz *)malloc(sizeof(struct hiz));
+  h->tiles_x = (zb->width + HIZ_TILE - 1) / HIZ_TILE;
+  h->tiles_y = (zb->height + HIZ_TILE - 1) / HIZ_TILE;
+  h->tiles = (struct hiz_tile *)calloc(h->tiles_x * h->tiles_y,
+                                       sizeof(struct hiz_tile));
+  zb->hiz = h;
+  clear_hiz(zb);
+}
+
+/*======== void disable_hiz() ==========
+Inputs:   zbuffer zb
+Returns:
+
+Frees the tiles of zb
+====================*/
+void disable_hiz( zbuffer zb ) {
+
+  if ( !zb->hiz )
+    return;
+  free(zb->hiz->tiles);
+  free(zb->hiz);
+  zb->hiz = NULL;
+}
+
+/*======== void clear_hiz() ==========
+Inputs:   zbuffer zb
+Returns:
+
+Resets every tile to match a cleared zbuffer and
+zeroes the counters
+====================*/
+void clear_hiz( zbuffer zb ) {
+
+  struct hiz *h = zb->hiz;
+  int t;
+
+  if ( !h )
+    return;
+  for (t = 0; t < h->tiles_x * h->tiles_y; t++) {
+    h->tiles[t].zmin = LONG_MIN;
+    h->tiles[t].zmax = LONG_MIN;
+    h->tiles[t].dirty = 0;
+    h->tiles[t].triangles_rejected = 0;
+    h->tiles[t].pixels_rejected = 0;
+  }
+}
+
+/*======== static void refresh_tile() ==========
+Inputs:   zbuffer zb
+          int tx
+          int ty
+Returns:
+
+Rescans tile tx, ty to make its depth range exact
+====================*/
+static void refresh_tile( zbuffer zb, int tx, int ty ) {
+
+  struct hiz_tile *t = zb->hiz->tiles + ty * zb->hiz->tiles_x + tx;
+  double *z;
+  double zmin, zmax;
+  int x, row, x1, row1;
+
+  x1 = (tx + 1) * HIZ_TILE < zb->width ? (tx + 1) * HIZ_TILE : zb->width;
+  row1 = (ty + 1) * HIZ_TILE < zb->height ? (ty + 1) * HIZ_TILE : zb->height;
+  zmin = zmax = zb->z[ty * HIZ_TILE * zb->width + tx * HIZ_TILE];
+  for (row = ty * HIZ_TILE; row < row1; row++) {
+    z = zb->z + row * zb->width;
+    for (x = tx * HIZ_TILE; x < x1; x++) {
+      zmin = z[x] < zmin ? z[x] : zmin;
+      zmax = z[x] > zmax ? z[x] : zmax;
+    }
+  }
+  t->zmin = zmin;
+  t->zmax = zmax;
+  t->dirty = 0;
+}
+
+/*======== void load_hiz() ==========
+Inputs:   zbuffer zb
+Returns:
+
+Makes every tile exact for the depths now in zb and zeroes
+the counters, for when a whole zbuffer is copied in instead
+of cleared
+====================*/
+void load_hiz( zbuffer zb ) {
+
+  struct hiz *h = zb->hiz;
+  int tx, ty;
+
+  if ( !h )
+    return;
+  clear_hiz(zb);
+  for (ty = 0; ty < h->tiles_y; ty++)
+    for (tx = 0; tx < h->tiles_x; tx++)
+      refresh_tile(zb, tx, ty);
+}
+
+/*======== static int behind_tile() ==========
+Inputs:   zbuffer zb
+          int tx
+          int ty
+          double z
+Returns: 1 if no pixel of tile tx, ty would take depth z
+====================*/
+static int behind_tile( zbuffer zb, int tx, int ty, double z ) {
+
+  struct hiz_tile *t = zb->hiz->tiles + ty * zb->hiz->tiles_x + tx;
+
+  if ( z < t->zmin )
+    return 1;
+  if ( t->dirty ) {
+    refresh_tile(zb, tx, ty);
+    return z < t->zmin;
+  }
+  return 0;
+}
+
+/*======== int hiz_reject_triangle() ==========
+Inputs:   screen s
+          zbuffer zb
+          struct matrix *points
+          int i
+Returns: 1 if triangle i of points is hidden everywhere
+         inside the clip rectangle of s
+
+Every pixel the triangle (and its outline) can touch gets a
+depth within the range of its vertices, so the triangle is
+hidden when its nearest vertex is behind every tile under
+its bounding box.
+====================*/
+int hiz_reject_triangle( screen s, zbuffer zb, struct matrix *points, int i ) {
+
+  double xmin, xmax, ymin, ymax, zmax, rmin, rmax;
+  int tx, ty, tx0, tx1, ty0, ty1, k;
+
+  xmin = xmax = points->m[0][i];
+  ymin = ymax = points->m[1][i];
+  zmax = points->m[2][i];
+  for (k = 1; k < 3; k++) {
+    xmin = fmin(xmin, points->m[0][i+k]);
+    xmax = fmax(xmax, points->m[0][i+k]);
+    ymin = fmin(ymin, points->m[1][i+k]);
+    ymax = fmax(ymax, points->m[1][i+k]);
+    zmax = fmax(zmax, points->m[2][i+k]);
+  }
+
+  //same padded box as the tile binner uses, clipped
+  xmin = fmax(floor(xmin) - 1, s->clip_x0);
+  xmax = fmin(ceil(xmax) + 1, s->clip_x1 - 1);
+  rmin = fmax(s->height - 1 - ceil(ymax) - 1, s->clip_y0);
+  rmax = fmin(s->height - 1 - floor(ymin) + 1, s->clip_y1 - 1);
+  if ( !(xmin <= xmax && rmin <= rmax) || isnan(zmax) )
+    return 0;
+
+  zmax = round_depth(zmax + depth_slack(zmax, 0));
+  tx0 = (int)xmin / HIZ_TILE;
+  tx1 = (int)xmax / HIZ_TILE;
+  ty0 = (int)rmin / HIZ_TILE;
+  ty1 = (int)rmax / HIZ_TILE;
+  for (ty = ty0; ty <= ty1; ty++)
+    for (tx = tx0; tx <= tx1; tx++)
+      if ( !behind_tile(zb, tx, ty, zmax) )
+        return 0;
+
+  zb->hiz->tiles[ty0 * zb->hiz->tiles_x + tx0].triangles_rejected++;
+  return 1;
+}
+
+/*======== int hiz_test_span() ==========
+Inputs:   zbuffer zb
+          int x
+          int row
+          int n
+          double z
+          double dz
+Returns: HIZ_REJECT, HIZ_ACCEPT or HIZ_TEST
+
+Classifies the n pixels starting at x, row, all in one tile,
+whose depths start at z and step by dz. HIZ_REJECT means none
+of them would pass a z test, HIZ_ACCEPT means all of them
+would, and HIZ_TEST means they must be tested one by one.
+====================*/
+int hiz_test_span( zbuffer zb, int x, int row, int n, double z, double dz ) {
+
+  struct hiz_tile *t;
+  double zend, slack, znear, zfar;
+  int tx = x / HIZ_TILE;
+  int ty = row / HIZ_TILE;
+
+  zend = z + dz * (n - 1);
+  slack = depth_slack(z, dz * n);
+  znear = round_depth(fmax(z, zend) + slack);
+  zfar = round_depth(fmin(z, zend) - slack);
+
+  if ( behind_tile(zb, tx, ty, znear) ) {
+    zb->hiz->tiles[ty * zb->hiz->tiles_x + tx].pixels_rejected += n;
+    return HIZ_REJECT;
+  }
+  t = zb->hiz->tiles + ty * zb->hiz->tiles_x + tx;
+  if ( zfar >= t->zmax )
+    return HIZ_ACCEPT;
+  return HIZ_TEST;
+}
+
+/*======== void hiz_mark_rect() ==========
+Inputs:   zbuffer zb
+          int x0
+          int x1
+          int row0
+          int row1
+          double z
+Returns:
+
+Records that depths no nearer than z may have been written
+anywhere in columns [x0, x1) of rows [row0, row1)
+====================*/
+void hiz_mark_rect( zbuffer zb, int x0, int x1, int row0, int row1, double z ) {
+
+  struct hiz_tile *t;
+  int tx, ty;
+
+  if ( x0 >= x1 || row0 >= row1 )
+    return;
+  z = round_depth(z + depth_slack(z, 0));
+  for (ty = row0 / HIZ_TILE; ty <= (row1 - 1) / HIZ_TILE; ty++)
+    for (tx = x0 / HIZ_TILE; tx <= (x1 - 1) / HIZ_TILE; tx++) {
+      t = zb->hiz->tiles + ty * zb->hiz->tiles_x + tx;
+      if ( z > t->zmax )
+        t->zmax = z;
+      t->dirty = 1;
+    }
+}
+
+/*======== void hiz_stats() ==========
+Inputs:   zbuffer zb
+          long *triangles
+          long *pixels
+Returns:
+
+Sums up how many triangles and span pixels were thrown
+away since zb was last cleared. When the screen is drawn
+in tiles, a triangle counts once for every tile it was
+rejected in.
+====================*/
+void hiz_stats( zbuffer zb, long *triangles, long *pixels ) {
+
+  struct hiz *h = zb->hiz;
+  int t;
+
+  *triangles = 0;
+  *pixels = 0;
+  if ( !h )
+    return;
+  for (t = 0; t < h->tiles_x * h->tiles_y; t++) {
+    *triangles += h->tiles[t].triangles_rejected;
+    *pixels += h->tiles[t].pixels_rejected;
+  }
+}
@@ -0,0 +1,65 @@
+#ifndef HIZ_H
+#define HIZ_H
+
+#include "matrix.h"
+#include "ml6.h"
+
+//width and height in pixels of a hierarchical z tile,
+//TILE_SIZE in raster.h must be a multiple of it
+#define HIZ_TILE 8
+
+//verdicts of hiz_test_span
+#define HIZ_TEST 0
+#define HIZ_REJECT 1
+#define HIZ_ACCEPT 2
+
+/*
+  Depth bounds for a HIZ_TILE x HIZ_TILE block of the zbuffer.
+  Larger z is nearer, so zmin is the farthest depth in the
+  block and zmax the nearest. zmin is only ever too low and
+  zmax only ever too high, both are made exact again when
+  a dirty tile is refreshed.
+  The counters live here so that threads drawing different
+  tiles never share them.
+*/
+struct hiz_tile {
+  double zmin, zmax;
+  int dirty;
+  long triangles_rejected;
+  long pixels_rejected;
+};
+
+struct hiz {
+  int tiles_x, tiles_y;
+  struct hiz_tile *tiles;
+};
+
+void enable_hiz( zbuffer zb );
+void disable_hiz( zbuffer zb );
+void clear_hiz( zbuffer zb );
+void load_hiz( zbuffer zb );
+int hiz_reject_triangle( screen s, zbuffer zb, struct matrix *points, int i );
+int hiz_test_span( zbuffer zb, int x, int row, int n, double z, double dz );
+void hiz_mark_rect( zbuffer zb, int x0, int x1, int row0, int row1, double z );
+void hiz_stats( zbuffer zb, long *triangles, long *pixels );
+
+/*======== void hiz_mark() ==========
+Inputs:   zbuffer zb
+          int x
+          int row
+          double z
+Returns:
+
+Records that depth z was just written at x, row
+====================*/
+static inline void hiz_mark( zbuffer zb, int x, int row, double z ) {
+
+  struct hiz_tile *t = zb->hiz->tiles + (row / HIZ_TILE) * zb->hiz->tiles_x
+    + x / HIZ_TILE;
+
+  if ( z > t->zmax )
+    t->zmax = z;
+  t->dirty = 1;
+}
+
+#endif
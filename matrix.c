@@ -1,6 +1,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MATRIX_X86
+#endif
 
 #include "matrix.h"
 
@@ -200,6 +206,75 @@ struct matrix * make_rotZ(double theta) {
 }
 
 
+/*======== void translate_matrix() ==========
+Inputs:  struct matrix *m
+         double x
+         double y
+         double z 
+Returns: 
+
+m * make_translate(x, y, z) -> m, for a 4x4 m, worked out in
+place. Only the last column changes.
+====================*/
+void translate_matrix(struct matrix *m, double x, double y, double z) {
+  int r;
+  for (r=0; r < 4; r++)
+    m->m[r][3] = m->m[r][0] * x + m->m[r][1] * y + m->m[r][2] * z + m->m[r][3];
+}
+
+/*======== void scale_matrix() ==========
+Inputs:  struct matrix *m
+         double x
+         double y
+         double z 
+Returns: 
+
+m * make_scale(x, y, z) -> m, for a 4x4 m, worked out in place
+====================*/
+void scale_matrix(struct matrix *m, double x, double y, double z) {
+  int r;
+  for (r=0; r < 4; r++) {
+    m->m[r][0]*= x;
+    m->m[r][1]*= y;
+    m->m[r][2]*= z;
+  }
+}
+
+/*======== void rotate_matrix() ==========
+Inputs:  struct matrix *m
+         int axis
+         double theta 
+Returns: 
+
+m * make_rotX(theta) -> m (or rotY, rotZ for axis 1, 2), for a
+4x4 m, worked out in place. Only the two columns the rotation
+mixes change.
+====================*/
+void rotate_matrix(struct matrix *m, int axis, double theta) {
+  double c = cos(theta), s = sin(theta);
+  double a, b, mi, mj;
+  int r, i, j;
+
+  //column i becomes i * c + j * b, and column j i * a + j * c
+  if ( axis == 0 ) {
+    i = 1; j = 2; a = -s; b = s;
+  }
+  else if ( axis == 1 ) {
+    i = 0; j = 2; a = s; b = -s;
+  }
+  else {
+    i = 0; j = 1; a = -s; b = s;
+  }
+
+  for (r=0; r < 4; r++) {
+    mi = m->m[r][i];
+    mj = m->m[r][j];
+    m->m[r][i] = mi * c + mj * b;
+    m->m[r][j] = mi * a + mj * c;
+  }
+}
+
+
 /*-------------- void print_matrix() --------------
 Inputs:  struct matrix *m 
 Returns: 
@@ -250,31 +325,131 @@ void scalar_mult(double x, struct matrix *m) {
 }//end scalar_mult
 
 
+/*======== static int is_affine() ==========
+Inputs:  struct matrix *a
+Returns: 1 if a is a 4x4 matrix whose bottom row is 0 0 0 1
+====================*/
+static int is_affine(struct matrix *a) {
+  return a->rows == 4 && a->cols == 4 &&
+    a->m[3][0] == 0 && a->m[3][1] == 0 && a->m[3][2] == 0 && a->m[3][3] == 1;
+}
+
+#ifdef MATRIX_X86
+/*======== static int affine_avx() ==========
+Inputs:  struct matrix *a
+         struct matrix *b 
+Returns: The number of columns of b done
+
+Transforms the points of b by the affine matrix a, four at a
+time. Each result is summed in the same order as the scalar
+code, without fused multiply-adds, so it is exactly the same.
+====================*/
+__attribute__((target("avx")))
+static int affine_avx(struct matrix *a, struct matrix *b) {
+
+  __m256d k[3][4], x, y, z, w;
+  double *px = b->m[0], *py = b->m[1], *pz = b->m[2], *pw = b->m[3];
+  int r, c;
+
+  for (r=0; r < 3; r++)
+    for (c=0; c < 4; c++)
+      k[r][c] = _mm256_set1_pd(a->m[r][c]);
+
+  for (c=0; c + 4 <= b->lastcol; c+= 4) {
+    x = _mm256_load_pd(px + c);
+    y = _mm256_load_pd(py + c);
+    z = _mm256_load_pd(pz + c);
+    w = _mm256_load_pd(pw + c);
+    for (r=0; r < 3; r++)
+      _mm256_store_pd(b->m[r] + c,
+                      _mm256_add_pd(_mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(k[r][0], x),
+                                                                _mm256_mul_pd(k[r][1], y)),
+                                                  _mm256_mul_pd(k[r][2], z)),
+                                    _mm256_mul_pd(k[r][3], w)));
+  }
+  return c;
+}
+
+/*======== static int affine_sse2() ==========
+Inputs:  struct matrix *a
+         struct matrix *b 
+Returns: The number of columns of b done
+
+affine_avx two points at a time
+====================*/
+__attribute__((target("sse2")))
+static int affine_sse2(struct matrix *a, struct matrix *b) {
+
+  __m128d k[3][4], x, y, z, w;
+  double *px = b->m[0], *py = b->m[1], *pz = b->m[2], *pw = b->m[3];
+  int r, c;
+
+  for (r=0; r < 3; r++)
+    for (c=0; c < 4; c++)
+      k[r][c] = _mm_set1_pd(a->m[r][c]);
+
+  for (c=0; c + 2 <= b->lastcol; c+= 2) {
+    x = _mm_load_pd(px + c);
+    y = _mm_load_pd(py + c);
+    z = _mm_load_pd(pz + c);
+    w = _mm_load_pd(pw + c);
+    for (r=0; r < 3; r++)
+      _mm_store_pd(b->m[r] + c,
+                   _mm_add_pd(_mm_add_pd(_mm_add_pd(_mm_mul_pd(k[r][0], x),
+                                                    _mm_mul_pd(k[r][1], y)),
+                                         _mm_mul_pd(k[r][2], z)),
+                              _mm_mul_pd(k[r][3], w)));
+  }
+  return c;
+}
+#endif
+
 /*-------------- void matrix_mult() --------------
 Inputs:  struct matrix *a
          struct matrix *b 
 Returns: 
 
 a*b -> b
+
+When a is affine, as every transform is, the w row of b stays
+as it is and the rest is done with AVX or SSE2 when the CPU
+has them. Either way, every point comes out the same.
 */
 void matrix_mult(struct matrix *a, struct matrix *b) {
-  int r, c;
-  struct matrix *tmp;
-  tmp = new_matrix(4, 1);
-  
+  int r, c = 0;
+  double tmp[4];
+
+  if ( b->rows == 4 && is_affine(a) ) {
+#ifdef MATRIX_X86
+    if ( __builtin_cpu_supports("avx") )
+      c = affine_avx(a, b);
+    else if ( __builtin_cpu_supports("sse2") )
+      c = affine_sse2(a, b);
+#endif
+    for (; c < b->lastcol; c++) {
+      for (r=0; r < 4; r++)
+        tmp[r] = b->m[r][c];
+      for (r=0; r < 3; r++)
+        b->m[r][c] = a->m[r][0] * tmp[0] +
+          a->m[r][1] * tmp[1] +
+          a->m[r][2] * tmp[2] +
+          a->m[r][3] * tmp[3];
+    }
+    return;
+  }
+
   for (c=0; c < b->lastcol; c++) {
 
     //copy current col (point) to tmp
     for (r=0; r < b->rows; r++)      
-      tmp->m[r][0] = b->m[r][c];
+      tmp[r] = b->m[r][c];
     
     for (r=0; r < b->rows; r++) 
-      b->m[r][c] = a->m[r][0] * tmp->m[0][0] +
-	a->m[r][1] * tmp->m[1][0] +
-	a->m[r][2] * tmp->m[2][0] +
-	a->m[r][3] * tmp->m[3][0];
+      b->m[r][c] = a->m[r][0] * tmp[0] +
+	a->m[r][1] * tmp[1] +
+	a->m[r][2] * tmp[2] +
+	a->m[r][3] * tmp[3];
   }
-  free_matrix(tmp);
 }//end matrix_mult
 
 
@@ -282,6 +457,38 @@ void matrix_mult(struct matrix *a, struct matrix *b) {
   These Functions do not need to be modified
   ===============================================*/
 
+/*======== static size_t row_stride() ==========
+Inputs:  int cols
+Returns: The number of doubles from one row of a matrix with
+cols columns to the next, a whole number of MATRIX_ALIGN blocks
+====================*/
+static size_t row_stride(int cols) {
+  size_t per_block = MATRIX_ALIGN / sizeof(double);
+  return (cols + per_block - 1) / per_block * per_block;
+}
+
+/*======== static double *alloc_rows() ==========
+Inputs:  struct matrix *m
+         int cols 
+Returns: The block of doubles m->m now points in to
+
+Allocates room for m->rows rows of cols columns in one block
+and points the rows of m at it
+====================*/
+static double *alloc_rows(struct matrix *m, int cols) {
+  size_t stride = row_stride(cols ? cols : 1);
+  void *block;
+  int i;
+
+  if ( posix_memalign(&block, MATRIX_ALIGN, m->rows * stride * sizeof(double)) ) {
+    printf("error: could not allocate a %dx%d matrix\n", m->rows, cols);
+    exit(1);
+  }
+  for (i=0; i < m->rows; i++)
+    m->m[i] = (double *)block + i * stride;
+  return (double *)block;
+}
+
 /*-------------- struct matrix *new_matrix() --------------
 Inputs:  int rows
          int cols 
@@ -290,22 +497,19 @@ Returns:
 Once allocated, access the matrix as follows:
 m->m[r][c]=something;
 if (m->lastcol)... 
+
+The row pointers live right after the struct, and the rows in
+one aligned block that m->m[0] points to.
 */
 struct matrix *new_matrix(int rows, int cols) {
-  double **tmp;
-  int i;
   struct matrix *m;
 
-  tmp = (double **)malloc(rows * sizeof(double *));
-  for (i=0;i<rows;i++) {
-      tmp[i]=(double *)malloc(cols * sizeof(double));
-    }
-
-  m=(struct matrix *)malloc(sizeof(struct matrix));
-  m->m=tmp;
+  m = (struct matrix *)malloc(sizeof(struct matrix) + rows * sizeof(double *));
+  m->m = (double **)(m + 1);
   m->rows = rows;
   m->cols = cols;
   m->lastcol = 0;
+  alloc_rows(m, cols);
 
   return m;
 }
@@ -315,36 +519,40 @@ struct matrix *new_matrix(int rows, int cols) {
 Inputs:  struct matrix *m 
 Returns: 
 
-1. free individual rows
-2. free array holding row pointers
-3. free actual matrix
+frees the block of rows, then the matrix itself
 */
 void free_matrix(struct matrix *m) {
 
-  int i;
-  for (i=0;i<m->rows;i++) {
-      free(m->m[i]);
-    }
-  free(m->m);
+  free(m->m[0]);
   free(m);
 }
 
 
-/*======== void grow_matrix() ==========
+/*======== void reserve_matrix() ==========
 Inputs:  struct matrix *m
-         int newcols 
+         int cols 
 Returns: 
 
-Reallocates the memory for m->m such that it now has
-newcols number of collumns
+Makes sure m has room for at least cols columns, keeping
+what it holds. Room at least doubles each time, so adding
+points one at a time takes amortized constant time.
 ====================*/
-void grow_matrix(struct matrix *m, int newcols) {
-  
+void reserve_matrix(struct matrix *m, int cols) {
+
+  double *old = m->m[0];
+  size_t stride = row_stride(m->cols);
   int i;
-  for (i=0;i<m->rows;i++) {
-      m->m[i] = realloc(m->m[i],newcols*sizeof(double));
-  }
-  m->cols = newcols;
+
+  if ( cols <= m->cols )
+    return;
+  if ( cols < 2 * m->cols )
+    cols = 2 * m->cols;
+
+  alloc_rows(m, cols);
+  for (i=0; i < m->rows; i++)
+    memcpy(m->m[i], old + i * stride, m->cols * sizeof(double));
+  free(old);
+  m->cols = cols;
 }
 
 
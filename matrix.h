@@ -4,6 +4,16 @@
 #define HERMITE 0
 #define BEZIER 1
 
+//rows of a matrix start on this many byte boundaries, so whole
+//vectors of x, y or z can be loaded at once
+#define MATRIX_ALIGN 64
+
+/*
+  rows x cols doubles in one aligned block, row r at m[r]. A
+  matrix of points keeps one point per column, so its rows are
+  planes of x, y, z and w. Points are always added with w = 1,
+  and affine transforms leave the w plane as it is.
+*/
 struct matrix {
   double **m;
   int rows, cols;
@@ -23,10 +33,15 @@ struct matrix * make_rotX(double theta);
 struct matrix * make_rotY(double theta);
 struct matrix * make_rotZ(double theta);
 
+//the same transforms applied to a 4x4 matrix in place
+void translate_matrix(struct matrix *m, double x, double y, double z);
+void scale_matrix(struct matrix *m, double x, double y, double z);
+void rotate_matrix(struct matrix *m, int axis, double theta);
+
 //Basic matrix manipulation routines
 struct matrix *new_matrix(int rows, int cols);
 void free_matrix(struct matrix *m);
-void grow_matrix(struct matrix *m, int newcols);
+void reserve_matrix(struct matrix *m, int cols);
 void copy_matrix(struct matrix *a, struct matrix *b);
 void print_matrix(struct matrix *m);
 void ident(struct matrix *m);
@@ -33,7 +33,7 @@
 %token <string> STRING
 %token <string> SET MOVE SCALE ROTATE BASENAME SAVE_KNOBS TWEEN FRAMES VARY
 %token <string> PUSH POP SAVE GENERATE_RAYFILES
-%token <string> SHADING SHADING_TYPE SETKNOBS FOCAL DISPLAY WEB
+%token <string> SHADING SHADING_TYPE SETKNOBS FOCAL DISPLAY WEB RESOLUTION
 %token <string> CO
 %%
 /* Grammar rules */
@@ -751,6 +751,14 @@ WEB
   op[lastop].opcode = WEB;
   lastop++;
 }|
+RESOLUTION DOUBLE DOUBLE
+{
+  lineno++;
+  op[lastop].opcode = RESOLUTION;
+  op[lastop].op.resolution.width = $2;
+  op[lastop].op.resolution.height = $3;
+  lastop++;
+}|
 AMBIENT DOUBLE DOUBLE DOUBLE
 {
   lineno++;
@@ -788,7 +796,13 @@ extern FILE *yyin;
 
 int main(int argc, char **argv) {
 
-  yyin = fopen(argv[1],"r");
+  int script = parse_options(argc, argv);
+
+  yyin = fopen(argv[script],"r");
+  if (!yyin) {
+    printf("error: could not open %s\n", argv[script]);
+    exit(1);
+  }
 
   yyparse();
   //COMMENT OUT PRINT_PCODE AND UNCOMMENT
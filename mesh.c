@@ -1,40 +1,776 @@
+#include <limits.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
 #include "mesh.h"
 
-struct matrix *parse_mesh(char *file) {
-    struct matrix *polygons = new_matrix(4, 1000);
-    struct matrix *verticies = new_matrix(4, 1000);
+/*
+  Every mesh file read so far, newest first. Shared by all the
+  drawing threads, so each file is read once per run.
+*/
+static struct mesh *mesh_cache = NULL;
+static long mesh_hits = 0;
+static long mesh_misses = 0;
+static pthread_mutex_t mesh_lock = PTHREAD_MUTEX_INITIALIZER;
 
-    FILE *f;
-    f = fopen(file, "r");
+int mesh_threads = 1;
 
-    if (!f) {
-        printf("error: file could not be opened\n");
-        exit(1);
+/*
+  A run of whole lines of an OBJ file, parsed on its own thread.
+  The first pass only counts the vertices and triangles in it, so
+  the second can put them straight in to place after those of the
+  chunks before it. vertex_base is also what negative indices
+  count back from.
+*/
+struct obj_chunk {
+    const char *start, *end;
+    struct mesh *mesh;
+    int pass;
+    long num_vertices, num_triangles;
+    long vertex_base, triangle_base;
+    const char *bad_line;
+};
+
+//every power of ten a double holds exactly
+static const double powers_of_ten[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+#define OBJ_SPACE(c) ((c) == ' ' || (c) == '\t' || (c) == '\r')
+#define OBJ_DIGIT(c) ((c) >= '0' && (c) <= '9')
+
+/*======== static const char *skip_token() ==========
+  Inputs:   const char *p
+  const char *end
+  Returns: The first space or line end at or after p
+  ====================*/
+static const char *skip_token(const char *p, const char *end) {
+
+    while (p < end && !OBJ_SPACE(*p) && *p != '\n')
+        p++;
+    return p;
+}
+
+/*======== static const char *next_field() ==========
+  Inputs:   const char *p
+  const char *end
+  Returns: The start of the next field of the line p is in,
+  or NULL at the end of the line or a comment
+  ====================*/
+static const char *next_field(const char *p, const char *end) {
+
+    while (p < end && OBJ_SPACE(*p))
+        p++;
+    if (p == end || *p == '\n' || *p == '#')
+        return NULL;
+    return p;
+}
+
+/*======== static const char *parse_double() ==========
+  Inputs:   const char *p
+  const char *end
+  double *d
+  Returns: The end of the number at p, which is stored in d
+
+  Numbers of up to 19 significant digits with a power of ten
+  between -22 and 22 (every coordinate anyone writes) are put
+  together with a single rounding, which gives the same double
+  strtod does. Anything else is handed to strtod.
+  ====================*/
+static const char *parse_double(const char *p, const char *end, double *d) {
+
+    const char *token = p, *s;
+    uint64_t m = 0;
+    int digits = 0, scale = 0, e = 0, neg = 0, negexp = 0, exact = 1;
+    char buf[64];
+    size_t len;
+
+    if (p < end && (*p == '-' || *p == '+'))
+        neg = *p++ == '-';
+    s = p;
+    for (; p < end && OBJ_DIGIT(*p); p++)
+        if (digits < 19) {
+            m = 10 * m + (*p - '0');
+            digits += m > 0;
+        }
+        else {
+            scale++;
+            exact &= *p == '0';
+        }
+    if (p < end && *p == '.') {
+        for (p++; p < end && OBJ_DIGIT(*p); p++)
+            if (digits < 19) {
+                m = 10 * m + (*p - '0');
+                digits += m > 0;
+                scale--;
+            }
+            else
+                exact &= *p == '0';
     }
+    if (p == s || (p == s + 1 && *s == '.'))
+        exact = 0;
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        s = p + 1;
+        if (s < end && (*s == '-' || *s == '+'))
+            negexp = *s++ == '-';
+        if (s < end && OBJ_DIGIT(*s)) {
+            for (p = s; p < end && OBJ_DIGIT(*p); p++)
+                e = e < 10000 ? 10 * e + (*p - '0') : e;
+            scale += negexp ? -e : e;
+        }
+    }
+
+    if (exact && p == skip_token(p, end) &&
+        m <= (1ULL << 53) && scale >= -22 && scale <= 22) {
+        *d = scale < 0 ? m / powers_of_ten[-scale] : m * powers_of_ten[scale];
+        *d = neg ? -*d : *d;
+        return p;
+    }
+
+    //copied out, as the file need not end where strtod would stop
+    p = skip_token(token, end);
+    len = p - token;
+    len = len < sizeof(buf) ? len : sizeof(buf) - 1;
+    memcpy(buf, token, len);
+    buf[len] = '\0';
+    *d = strtod(buf, NULL);
+    return p;
+}
+
+/*======== static const char *parse_index() ==========
+  Inputs:   const char *p
+  const char *end
+  long vertices
+  long *index
+  Returns: The end of the face vertex at p
+
+  Sets index to the vertex a face vertex (v, v/vt, v//vn or
+  v/vt/vn) refers to, counting from 0. Negative indices count
+  back from the vertices read so far. index is set to -1 if
+  there is no index or it is 0.
+  ====================*/
+static const char *parse_index(const char *p, const char *end, long vertices,
+                               long *index) {
+
+    long i = 0;
+    int neg = 0;
+
+    if (p < end && *p == '-')
+        neg = *p++ == '-';
+    for (; p < end && OBJ_DIGIT(*p); p++)
+        i = i < LONG_MAX / 10 - 10 ? 10 * i + (*p - '0') : i;
+    if (!i)
+        *index = -1;
+    else
+        *index = neg ? vertices - i : i - 1;
+    return skip_token(p, end);
+}
 
-    char line[1024];
-    double x, y, z;
-    int v1, v2, v3, v4;
+/*======== static void count_obj_chunk() ==========
+  Inputs:   struct obj_chunk *c
+  Returns:
 
-    add_point(verticies, 0, 0, 0); // placeholder
+  Counts the vertices of chunk c, and the triangles its faces
+  will make once fanned out
+  ====================*/
+static void count_obj_chunk(struct obj_chunk *c) {
 
-    while (fgets(line, sizeof(line), f)) {
+    const char *p, *q, *end = c->end;
+    long n;
 
-        if (strncmp(line, "v ", 2) == 0) {
-            sscanf(line, "v %lf %lf %lf", &x, &y, &z);
-            add_point(verticies, x, y, z);
+    for (p = c->start; p < end; p++) {
+        while (p < end && OBJ_SPACE(*p))
+            p++;
+        if (p + 1 < end && OBJ_SPACE(p[1])) {
+            if (*p == 'v')
+                c->num_vertices++;
+            else if (*p == 'f') {
+                n = 0;
+                for (q = next_field(p + 1, end); q; q = next_field(skip_token(q, end), end))
+                    n++;
+                c->num_triangles += n > 2 ? n - 2 : 0;
+            }
         }
+        p = memchr(p, '\n', end - p);
+        if (!p)
+            break;
+    }
+}
+
+/*======== static void parse_obj_chunk() ==========
+  Inputs:   struct obj_chunk *c
+  Returns:
+
+  Reads the vertices and faces of chunk c in to its mesh, after
+  those of the chunks before it. Faces are split in to a fan of
+  triangles around their first vertex. The first bad face stops
+  the chunk and is left in bad_line.
+  ====================*/
+static void parse_obj_chunk(struct obj_chunk *c) {
+
+    const char *p, *q, *end = c->end;
+    double *v = c->mesh->vertices + 3 * c->vertex_base;
+    uint32_t *t = c->mesh->indices + 3 * c->triangle_base;
+    long vertices = c->vertex_base, total = c->mesh->num_vertices;
+    long first = 0, last = 0, index;
+    int k, n;
+
+    for (p = c->start; p < end; p++) {
+        while (p < end && OBJ_SPACE(*p))
+            p++;
+        if (p + 1 < end && OBJ_SPACE(p[1])) {
+            if (*p == 'v') {
+                q = p + 1;
+                for (k = 0; k < 3; k++) {
+                    q = next_field(q, end);
+                    v[k] = 0;
+                    if (q)
+                        q = parse_double(q, end, v + k);
+                }
+                v += 3;
+                vertices++;
+            }
+            else if (*p == 'f') {
+                n = 0;
+                for (q = next_field(p + 1, end); q; q = next_field(q, end)) {
+                    q = parse_index(q, end, vertices, &index);
+                    if (index < 0 || index >= total) {
+                        c->bad_line = p;
+                        return;
+                    }
+                    if (n == 0)
+                        first = index;
+                    else if (n >= 2) {
+                        t[0] = first;
+                        t[1] = last;
+                        t[2] = index;
+                        t += 3;
+                    }
+                    last = index;
+                    n++;
+                }
+            }
+        }
+        p = memchr(p, '\n', end - p);
+        if (!p)
+            break;
+    }
+}
+
+/*======== static void *obj_worker() ==========
+  Inputs:   void *arg
+  Returns: NULL
+
+  Runs the current pass over the chunk arg points to
+  ====================*/
+static void *obj_worker(void *arg) {
+
+    struct obj_chunk *c = (struct obj_chunk *)arg;
+
+    if (c->pass == 0)
+        count_obj_chunk(c);
+    else
+        parse_obj_chunk(c);
+    return NULL;
+}
+
+/*======== static void run_obj_pass() ==========
+  Inputs:   struct obj_chunk *chunks
+  int n
+  int pass
+  Returns:
+
+  Runs pass over the n chunks, each on its own thread (the first
+  on this one)
+  ====================*/
+static void run_obj_pass(struct obj_chunk *chunks, int n, int pass) {
+
+    pthread_t threads[MESH_MAX_THREADS];
+    int started[MESH_MAX_THREADS];
+    int k;
+
+    for (k = 0; k < n; k++)
+        chunks[k].pass = pass;
+    for (k = 1; k < n; k++) {
+        started[k] = !pthread_create(threads + k, NULL, obj_worker, chunks + k);
+        if (!started[k])
+            obj_worker(chunks + k);
+    }
+    obj_worker(chunks);
+    for (k = 1; k < n; k++)
+        if (started[k])
+            pthread_join(threads[k], NULL);
+}
+
+/*======== static int read_obj() ==========
+  Inputs:   char *file
+  struct mesh *mesh
+  Returns: 0 on success, -1 if file could not be read
+
+  Reads the vertices and triangles of the OBJ file in to mesh.
+  Vertex indices are stored counting from 0.
+
+  The file is mapped and split in to line aligned chunks, one
+  for each of mesh_threads threads (fewer if they would be
+  smaller than MESH_CHUNK_BYTES). The chunks are parsed in two
+  passes: one that counts, so the arrays are allocated once,
+  and one that fills them in.
+  ====================*/
+static int read_obj(char *file, struct mesh *mesh) {
+
+    struct obj_chunk chunks[MESH_MAX_THREADS];
+    struct stat st;
+    const char *data, *p, *end;
+    long nv = 0, nt = 0;
+    int fd, n, k, err = 0;
+
+    fd = open(file, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st)) {
+        printf("error: could not open %s\n", file);
+        return -1;
+    }
+    if (st.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+    data = (const char *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        printf("error: could not map %s\n", file);
+        return -1;
+    }
+    madvise((void *)data, st.st_size, MADV_SEQUENTIAL);
+    end = data + st.st_size;
+
+    n = st.st_size / MESH_CHUNK_BYTES + 1;
+    n = n < mesh_threads ? n : mesh_threads;
+    n = n < MESH_MAX_THREADS ? n : MESH_MAX_THREADS;
+    n = n > 1 ? n : 1;
+    memset(chunks, 0, sizeof(chunks));
+    for (k = 0; k < n; k++) {
+        chunks[k].mesh = mesh;
+        chunks[k].start = k ? chunks[k - 1].end : data;
+        p = data + st.st_size / n * (k + 1);
+        if (k == n - 1 || p <= chunks[k].start)
+            chunks[k].end = k == n - 1 ? end : chunks[k].start;
+        else {
+            p = memchr(p - 1, '\n', end - p + 1);
+            chunks[k].end = p ? p + 1 : end;
+        }
+    }
+
+    run_obj_pass(chunks, n, 0);
+    for (k = 0; k < n; k++) {
+        chunks[k].vertex_base = nv;
+        chunks[k].triangle_base = nt;
+        nv += chunks[k].num_vertices;
+        nt += chunks[k].num_triangles;
+    }
+    if (nv > INT_MAX / 3 || nt > INT_MAX / 3) {
+        printf("error: %s has too many vertices or faces\n", file);
+        munmap((void *)data, st.st_size);
+        return -1;
+    }
+
+    mesh->num_vertices = nv;
+    mesh->num_triangles = nt;
+    mesh->vertices = (double *)malloc(3 * nv * sizeof(double) + 1);
+    mesh->indices = (uint32_t *)malloc(3 * nt * sizeof(uint32_t) + 1);
+    run_obj_pass(chunks, n, 1);
+
+    for (k = 0; k < n && !err; k++)
+        if (chunks[k].bad_line) {
+            p = memchr(chunks[k].bad_line, '\n', end - chunks[k].bad_line);
+            printf("error: bad face in %s: %.*s\n", file,
+                   (int)((p ? p : end) - chunks[k].bad_line), chunks[k].bad_line);
+            err = -1;
+        }
+    munmap((void *)data, st.st_size);
+    return err;
+}
+
+/*======== static int map_mesh() ==========
+  Inputs:   char *file
+  struct mesh *mesh
+  Returns: 0 on success, -1 if file is not a valid binary mesh
+
+  Maps the binary mesh file in to memory and points the arrays
+  of mesh at it. Nothing is copied; only the indices are read,
+  to check that they are in range.
+  ====================*/
+static int map_mesh(char *file, struct mesh *mesh) {
+
+    struct mesh_header *h;
+    struct stat st;
+    uint64_t nv, nt;
+    size_t k;
+    int fd;
+
+    fd = open(file, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st)) {
+        printf("error: could not open %s\n", file);
+        return -1;
+    }
+    if (st.st_size < (off_t)sizeof(struct mesh_header)) {
+        printf("error: %s is too short to be a mesh\n", file);
+        close(fd);
+        return -1;
+    }
+    mesh->map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mesh->map == MAP_FAILED) {
+        mesh->map = NULL;
+        printf("error: could not map %s\n", file);
+        return -1;
+    }
+    mesh->map_size = st.st_size;
+
+    h = (struct mesh_header *)mesh->map;
+    nv = h->num_vertices;
+    nt = h->num_triangles;
+    if (h->version != MESH_VERSION ||
+        h->vertex_offset % MESH_ALIGN || h->index_offset % MESH_ALIGN ||
+        h->normal_offset % MESH_ALIGN ||
+        h->vertex_offset + nv * 3 * sizeof(double) > mesh->map_size ||
+        h->index_offset + nt * 3 * sizeof(uint32_t) > mesh->map_size ||
+        ((h->flags & MESH_HAS_NORMALS) &&
+         h->normal_offset + nt * 3 * sizeof(double) > mesh->map_size)) {
+        printf("error: %s is not a version %d mesh from this kind of machine\n",
+               file, MESH_VERSION);
+        return -1;
+    }
 
-        else if (strncmp(line, "f", 1) == 0) {
-            sscanf(line, "f %d %d %d %d", &v1, &v2, &v3, &v4);
-            add_polygon(polygons,
-                        verticies->m[0][v1], verticies->m[1][v1], verticies->m[2][v1],
-                        verticies->m[0][v2], verticies->m[1][v2], verticies->m[2][v2],
-                        verticies->m[0][v3], verticies->m[1][v3], verticies->m[2][v3]);
+    mesh->num_vertices = nv;
+    mesh->num_triangles = nt;
+    mesh->vertices = (double *)((char *)mesh->map + h->vertex_offset);
+    mesh->indices = (uint32_t *)((char *)mesh->map + h->index_offset);
+    if (h->flags & MESH_HAS_NORMALS)
+        mesh->normals = (double *)((char *)mesh->map + h->normal_offset);
+    memcpy(mesh->bounds, h->bounds, sizeof(mesh->bounds));
+
+    for (k = 0; k < nt * 3; k++)
+        if (mesh->indices[k] >= nv) {
+            printf("error: bad vertex index in %s\n", file);
+            return -1;
         }
+    return 0;
+}
+
+/*======== static void mesh_normals() ==========
+  Inputs:   struct mesh *mesh
+  Returns:
+
+  Works out the normal of every triangle of mesh, AB x AC for
+  triangle ABC, the same way calculate_normals does
+  ====================*/
+static void mesh_normals(struct mesh *mesh) {
+
+    double *nx, *ny, *nz, *a, *b, *c;
+    double ax, ay, az, bx, by, bz;
+    int t;
+
+    mesh->normals = (double *)malloc(3 * (size_t)mesh->num_triangles * sizeof(double));
+    mesh->own_normals = 1;
+    nx = mesh->normals;
+    ny = nx + mesh->num_triangles;
+    nz = ny + mesh->num_triangles;
+    for (t = 0; t < mesh->num_triangles; t++) {
+        a = mesh->vertices + 3 * mesh->indices[3 * t];
+        b = mesh->vertices + 3 * mesh->indices[3 * t + 1];
+        c = mesh->vertices + 3 * mesh->indices[3 * t + 2];
+        ax = b[0] - a[0];
+        ay = b[1] - a[1];
+        az = b[2] - a[2];
+        bx = c[0] - a[0];
+        by = c[1] - a[1];
+        bz = c[2] - a[2];
+        nx[t] = ay * bz - az * by;
+        ny[t] = az * bx - ax * bz;
+        nz[t] = ax * by - ay * bx;
     }
+}
+
+/*======== static void mesh_bounds() ==========
+  Inputs:   struct mesh *mesh
+  Returns:
+
+  Sets the bounds of mesh from its vertices
+  ====================*/
+static void mesh_bounds(struct mesh *mesh) {
+
+    int v, k;
+
+    for (k = 0; k < 3; k++) {
+        mesh->bounds[0][k] = mesh->num_vertices ? mesh->vertices[k] : 0;
+        mesh->bounds[1][k] = mesh->bounds[0][k];
+    }
+    for (v = 1; v < mesh->num_vertices; v++)
+        for (k = 0; k < 3; k++) {
+            mesh->bounds[0][k] = fmin(mesh->bounds[0][k], mesh->vertices[3 * v + k]);
+            mesh->bounds[1][k] = fmax(mesh->bounds[1][k], mesh->vertices[3 * v + k]);
+        }
+}
+
+/*======== int read_mesh() ==========
+  Inputs:   char *file
+  struct mesh *mesh
+  Returns: 0 on success, -1 (after printing why) on failure
+
+  Reads an OBJ or binary mesh file in to mesh, telling them
+  apart by the magic number binary files start with. Normals
+  are worked out if the file does not have them.
+  ====================*/
+int read_mesh(char *file, struct mesh *mesh) {
 
+    char magic[4] = {0};
+    FILE *f;
+    int err;
+
+    memset(mesh, 0, sizeof(struct mesh));
+    f = fopen(file, "rb");
+    if (!f) {
+        printf("error: could not open %s\n", file);
+        return -1;
+    }
+    fread(magic, 1, 4, f);
     fclose(f);
 
-    return polygons;
+    if (!memcmp(magic, MESH_MAGIC, 4))
+        err = map_mesh(file, mesh);
+    else {
+        err = read_obj(file, mesh);
+        if (!err)
+            mesh_bounds(mesh);
+    }
+    if (err) {
+        release_mesh(mesh);
+        return -1;
+    }
+    if (!mesh->normals)
+        mesh_normals(mesh);
+
+    mesh->bytes = sizeof(struct mesh);
+    if (mesh->map)
+        mesh->bytes += mesh->map_size;
+    else
+        mesh->bytes += (long)mesh->num_vertices * 3 * sizeof(double) +
+            (long)mesh->num_triangles * 3 * sizeof(uint32_t);
+    if (mesh->own_normals)
+        mesh->bytes += (long)mesh->num_triangles * 3 * sizeof(double);
+    return 0;
+}
+
+/*======== static int write_block() ==========
+  Inputs:   FILE *f
+  void *data
+  size_t bytes
+  Returns: 0 on success, -1 on a write error
+
+  Writes bytes of data to f, then zeros up to the next
+  MESH_ALIGN boundary
+  ====================*/
+static int write_block(FILE *f, void *data, size_t bytes) {
+
+    static const char zeros[MESH_ALIGN] = {0};
+    size_t pad = (MESH_ALIGN - bytes % MESH_ALIGN) % MESH_ALIGN;
+
+    if (fwrite(data, 1, bytes, f) != bytes || fwrite(zeros, 1, pad, f) != pad)
+        return -1;
+    return 0;
+}
+
+/*======== int write_mesh() ==========
+  Inputs:   struct mesh *mesh
+  char *file
+  Returns: 0 on success, -1 if file could not be written
+
+  Saves mesh, with its normals and bounds, as a binary mesh
+  file that read_mesh can map
+  ====================*/
+int write_mesh(struct mesh *mesh, char *file) {
+
+    struct mesh_header h;
+    size_t vbytes, ibytes, nbytes;
+    FILE *f;
+    int err;
+
+#define ALIGNED(n) (((n) + MESH_ALIGN - 1) / MESH_ALIGN * MESH_ALIGN)
+    vbytes = (size_t)mesh->num_vertices * 3 * sizeof(double);
+    ibytes = (size_t)mesh->num_triangles * 3 * sizeof(uint32_t);
+    nbytes = (size_t)mesh->num_triangles * 3 * sizeof(double);
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, MESH_MAGIC, 4);
+    h.version = MESH_VERSION;
+    h.flags = MESH_HAS_NORMALS;
+    h.num_vertices = mesh->num_vertices;
+    h.num_triangles = mesh->num_triangles;
+    memcpy(h.bounds, mesh->bounds, sizeof(h.bounds));
+    h.vertex_offset = ALIGNED(sizeof(h));
+    h.index_offset = h.vertex_offset + ALIGNED(vbytes);
+    h.normal_offset = h.index_offset + ALIGNED(ibytes);
+#undef ALIGNED
+
+    f = fopen(file, "wb");
+    if (!f)
+        return -1;
+    err = write_block(f, &h, sizeof(h)) ||
+        write_block(f, mesh->vertices, vbytes) ||
+        write_block(f, mesh->indices, ibytes) ||
+        write_block(f, mesh->normals, nbytes);
+    if (fclose(f))
+        err = 1;
+    return err ? -1 : 0;
+}
+
+/*======== void release_mesh() ==========
+  Inputs:   struct mesh *mesh
+  Returns:
+
+  Frees or unmaps the arrays of mesh
+  ====================*/
+void release_mesh(struct mesh *mesh) {
+
+    if (mesh->map)
+        munmap(mesh->map, mesh->map_size);
+    else {
+        free(mesh->vertices);
+        free(mesh->indices);
+    }
+    if (!mesh->map || mesh->own_normals)
+        free(mesh->normals);
+    mesh->map = NULL;
+    mesh->vertices = mesh->normals = NULL;
+    mesh->indices = NULL;
+}
+
+/*======== struct mesh *load_mesh() ==========
+  Inputs:   char *file
+  Returns: The mesh in file, read on first use
+
+  Files are looked up by canonical path, so different names
+  for one file share an entry. If the file has been modified
+  since it was cached, it is read again. The mesh returned
+  belongs to the cache and must not be changed; use copy_mesh
+  to get triangles to transform.
+  ====================*/
+struct mesh *load_mesh(char *file) {
+
+    char path[PATH_MAX];
+    struct stat st;
+    struct mesh *mesh;
+
+    if (!realpath(file, path) || stat(path, &st)) {
+        printf("error: could not open %s\n", file);
+        exit(1);
+    }
+
+    pthread_mutex_lock(&mesh_lock);
+    for (mesh = mesh_cache; mesh; mesh = mesh->next)
+        if (!strcmp(mesh->path, path) && mesh->size == st.st_size &&
+            mesh->mtime.tv_sec == st.st_mtim.tv_sec &&
+            mesh->mtime.tv_nsec == st.st_mtim.tv_nsec) {
+            mesh_hits++;
+            pthread_mutex_unlock(&mesh_lock);
+            return mesh;
+        }
+
+    //an older copy of an edited file stays cached, another
+    //thread may still be copying it
+    mesh = (struct mesh *)malloc(sizeof(struct mesh));
+    if (read_mesh(path, mesh))
+        exit(1);
+    mesh->path = strdup(path);
+    mesh->mtime = st.st_mtim;
+    mesh->size = st.st_size;
+    mesh->bytes += strlen(path) + 1;
+    mesh->next = mesh_cache;
+    mesh_cache = mesh;
+    mesh_misses++;
+    pthread_mutex_unlock(&mesh_lock);
+    return mesh;
+}
+
+/*======== void copy_mesh() ==========
+  Inputs:   struct mesh *mesh
+  struct matrix *points
+  struct triangles *tris
+  struct normals *normals
+  Returns:
+
+  Replaces the points in points, the triangles in tris and the
+  normals in normals with those of mesh, growing them if
+  needed. Every vertex is copied once, for draw_triangles.
+  ====================*/
+void copy_mesh(struct mesh *mesh, struct matrix *points, struct triangles *tris,
+               struct normals *normals) {
+
+    int k, n = mesh->num_vertices;
+    double *v = mesh->vertices;
+
+    reserve_matrix(points, n);
+    for (k = 0; k < n; k++, v += 3) {
+        points->m[0][k] = v[0];
+        points->m[1][k] = v[1];
+        points->m[2][k] = v[2];
+        points->m[3][k] = 1;
+    }
+    points->lastcol = n;
+
+    tris->count = 0;
+    grow_triangles(tris, mesh->num_triangles);
+    memcpy(tris->v, mesh->indices, 3 * (size_t)mesh->num_triangles * sizeof(uint32_t));
+    tris->count = mesh->num_triangles;
+
+    grow_normals(normals, mesh->num_triangles);
+    memcpy(normals->x, mesh->normals, normals->count * sizeof(double));
+    memcpy(normals->y, mesh->normals + normals->count, normals->count * sizeof(double));
+    memcpy(normals->z, mesh->normals + 2 * normals->count, normals->count * sizeof(double));
+}
+
+/*======== void mesh_cache_stats() ==========
+  Inputs:   long *hits
+  long *misses
+  long *bytes
+  Returns:
+
+  Sets hits and misses to the number of load_mesh calls that
+  found their file in the cache or had to parse it, and bytes
+  to the memory the cache holds
+  ====================*/
+void mesh_cache_stats(long *hits, long *misses, long *bytes) {
+
+    struct mesh *mesh;
+
+    pthread_mutex_lock(&mesh_lock);
+    *hits = mesh_hits;
+    *misses = mesh_misses;
+    *bytes = 0;
+    for (mesh = mesh_cache; mesh; mesh = mesh->next)
+        *bytes += mesh->bytes;
+    pthread_mutex_unlock(&mesh_lock);
+}
+
+/*======== void free_mesh_cache() ==========
+  Inputs:
+  Returns:
+
+  Frees every cached mesh
+  ====================*/
+void free_mesh_cache() {
+
+    struct mesh *mesh;
+
+    pthread_mutex_lock(&mesh_lock);
+    while (mesh_cache) {
+        mesh = mesh_cache;
+        mesh_cache = mesh->next;
+        free(mesh->path);
+        release_mesh(mesh);
+        free(mesh);
+    }
+    pthread_mutex_unlock(&mesh_lock);
 }
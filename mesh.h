@@ -1,8 +1,14 @@
+#ifndef MESH_H
+#define MESH_H
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
 #include <string.h>
 #include <math.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
 
 #include "parser.h"
 #include "symtab.h"
@@ -13,4 +19,80 @@
 #include "stack.h"
 #include "gmath.h"
 
-struct matrix *parse_mesh(char *file);
+/*
+  Binary mesh files (made by objconvert) start with a
+  mesh_header. The arrays it points to start on MESH_ALIGN byte
+  boundaries: x, y, z of every vertex as doubles, then three
+  uint32 vertex indices per triangle, then, if the file has
+  MESH_HAS_NORMALS, the x of every triangle's normal, then
+  every y, then every z. Everything is in the byte order of
+  the machine that wrote it; version tells other machines
+  apart (it reads backwards there).
+*/
+#define MESH_MAGIC "MDLM"
+#define MESH_VERSION 1
+#define MESH_ALIGN 64
+#define MESH_HAS_NORMALS 1
+
+//OBJ files are parsed in chunks of at least this many bytes,
+//on up to MESH_MAX_THREADS threads
+#define MESH_CHUNK_BYTES 1048576
+#define MESH_MAX_THREADS 64
+
+//threads OBJ files are parsed on, set from --threads
+extern int mesh_threads;
+
+struct mesh_header {
+    char magic[4];
+    uint32_t version;
+    uint32_t flags;
+    uint32_t num_vertices;
+    uint32_t num_triangles;
+    uint32_t reserved;
+    double bounds[2][3];
+    uint64_t vertex_offset;
+    uint64_t index_offset;
+    uint64_t normal_offset;
+};
+
+/*
+  An indexed triangle mesh in object space, read from an OBJ
+  or binary mesh file. normals holds the (unnormalized) normal
+  of every triangle as in mesh_header; bounds holds the
+  smallest and largest x, y and z of the vertices.
+
+  When map is set the arrays point in to the mapped binary
+  file, apart from normals if own_normals is set; otherwise
+  they are all allocated.
+
+  Meshes in the cache also have the canonical path of their
+  file, and the mtime and size it had when it was read, so an
+  edited file is read again. They are never changed once
+  cached.
+*/
+struct mesh {
+    char *path;
+    struct timespec mtime;
+    off_t size;
+    int num_vertices, num_triangles;
+    double *vertices;
+    uint32_t *indices;
+    double *normals;
+    double bounds[2][3];
+    void *map;
+    size_t map_size;
+    int own_normals;
+    long bytes;
+    struct mesh *next;
+};
+
+int read_mesh(char *file, struct mesh *mesh);
+int write_mesh(struct mesh *mesh, char *file);
+void release_mesh(struct mesh *mesh);
+struct mesh *load_mesh(char *file);
+void copy_mesh(struct mesh *mesh, struct matrix *points, struct triangles *tris,
+               struct normals *normals);
+void mesh_cache_stats(long *hits, long *misses, long *bytes);
+void free_mesh_cache();
+
+#endif
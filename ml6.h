@@ -2,11 +2,12 @@
 
 Header file for fucntions we will use in ml6
 
-Sets the maximum XYES and YRES for images as well
+Sets the default XRES and YRES for images as well
 as the maximum color value you want to use.
 
-Creates the point structure in order to represent 
-a pixel as a color triple
+Creates the point structure in order to represent
+a color as a triple of ints, and the packed pixel
+structure the screen is made of
 =========================*/
 #ifndef ML6_H
 #define ML6_H
@@ -15,6 +16,9 @@ a pixel as a color triple
 #define YRES 500
 #define MAX_COLOR 255
 
+//alignment in bytes of heap allocated screen and zbuffer memory
+#define FB_ALIGN 64
+
 /*
   Every point has an individual int for
   each color value
@@ -36,15 +40,71 @@ struct point_t {
 */
 typedef struct point_t color;
 
+/*
+  A pixel in the framebuffer is stored as packed 8-bit channels
+  rather than as a color, so a 500x500 image takes 750KB instead
+  of 3MB. Compiling with -DFB_RGBX pads every pixel to 4 bytes so
+  that each one can be written with a single aligned 32-bit store.
+*/
+struct pixel_t {
+
+  unsigned char red;
+  unsigned char green;
+  unsigned char blue;
+#ifdef FB_RGBX
+  unsigned char pad;
+} __attribute__((aligned(4)));
+#else
+};
+#endif
+
+typedef struct pixel_t pixel;
+
 /*
   Likewise, we can use screen as a data type representing
-  an XRES x YRES array of colors.
+  a width x height image of pixels. Screens live on the heap
+  (see new_screen) and are stored row-major, so walking along
+  a scanline touches consecutive memory.
   eg:
-  screen s;
-  s[0][0] = c;
+  screen s = new_screen(XRES, YRES);
+  s->pixels[y * s->width + x].red = 255;
+
+  Drawing only touches pixels inside the clip rectangle, given
+  in pixel indicies as [clip_x0, clip_x1) x [clip_y0, clip_y1).
+  When bins is set, polygons and lines are queued for the tiled
+  rasterizer instead of being drawn right away (see raster.h).
 */
-typedef struct point_t screen[XRES][YRES];
+struct raster_bins;
+
+struct screen_t {
+
+  int width;
+  int height;
+  pixel *pixels;
+  int clip_x0, clip_y0, clip_x1, clip_y1;
+  struct raster_bins *bins;
+};
+typedef struct screen_t * screen;
+
+//z-buffer is a heap allocated array of doubles to store z values,
+//laid out row-major like the screen. When hiz is set it also keeps
+//the depth range of each small block of pixels (see hiz.h)
+struct hiz;
+
+struct zbuffer_t {
+
+  int width;
+  int height;
+  double *z;
+  struct hiz *hiz;
+};
+typedef struct zbuffer_t * zbuffer;
 
-//z-buffer is a 2d array of doubles to store z values
-typedef double zbuffer[XRES][YRES];
+//depths are stored rounded down to a multiple of 1/DEPTH_SCALE,
+//so that a line drawn over a surface is not lost to rounding
+//noise. The scale is a power of 2 so the rounding is exact, and
+//since it is monotonic a bound on z rounds to a bound on what
+//is stored. Needs math.h.
+#define DEPTH_SCALE 1024
+#define round_depth(z) (floor((z) * DEPTH_SCALE) / DEPTH_SCALE)
 #endif
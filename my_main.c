@@ -13,16 +13,18 @@
   push: push a new origin matrix onto the origin stack
   pop: remove the top matrix on the origin stack
 
-  move/scale/rotate: create a transformation matrix
-  based on the provided values, then
-  multiply the current top of the
-  origins stack by it.
+  move/scale/rotate: multiply the current top of the
+  origins stack by the transformation
+  for the provided values, in place.
 
   box/sphere/torus: create a solid object based on the
   provided values. Store that in a
   temporary matrix, multiply it by the
   current top of the origins stack, then
-  call draw_polygons.
+  call draw_polygons. Spheres, tori and
+  meshes share their points between
+  triangles, listed in tris, and are
+  drawn with draw_triangles.
 
   line: create a line based on the provided values. Stores
   that in a temporary matrix, multiply it by the
@@ -37,6 +39,9 @@
 #include <stdlib.h>
 #include <math.h>
 #include <string.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <pthread.h>
 #include "parser.h"
 #include "symtab.h"
 #include "y.tab.h"
@@ -49,6 +54,221 @@
 #include "gmath.h"
 #include "hash_table.h"
 #include "mesh.h"
+#include "raster.h"
+#include "hiz.h"
+#include "output.h"
+#include "png.h"
+#include "gif.h"
+#include "stream.h"
+#include "clip.h"
+
+int xres = 0;
+int yres = 0;
+double preview_scale = 1;
+int raster_threads = 0;
+int jobs = 1;
+int writers = 1;
+char *frame_format = "png";
+int gif_palette = GIF_LOCAL;
+int gif_dither = 0;
+char *stream_dest = NULL;
+int stream_format = STREAM_Y4M;
+struct video_stream *video_out = NULL;
+int use_hiz = 1;
+int use_layers = 1;
+double lod_tolerance = 0;
+
+/*======== void usage() ==========
+  Inputs:   char *prog
+  Returns:
+
+  Prints the command line options and exits
+  ====================*/
+void usage(char *prog) {
+    printf("usage: %s [options] <script>\n", prog);
+    printf("  -r, --resolution WxH     image size in pixels (default %dx%d)\n",
+           XRES, YRES);
+    printf("  -p, --preview-scale F    render at F times the resolution,\n"
+           "                           keeping scene coordinates\n");
+    printf("  -t, --threads N          rasterize tiles and compress PNGs on\n"
+           "                           N threads (default: one per CPU)\n");
+    printf("  -R, --rasterizer NAME    fill triangles with edge (watertight SIMD edge\n"
+           "                           functions, default) or scanline\n");
+    printf("  -j, --jobs N             draw N frames of an animation at once\n"
+           "                           (default 1; -t then defaults to 1)\n");
+    printf("  -w, --writers N          write images on N background threads\n"
+           "                           (default 1)\n");
+    printf("  -f, --frame-format EXT   save animation frames to anim/ as png\n"
+           "                           (default), ppm (binary P6), qoi or none\n");
+    printf("      --gif-palette MODE   local: a palette per GIF frame (default),\n"
+           "                           global: one palette from the first frame\n");
+    printf("      --gif-dither         dither GIF frames with over 255 colors\n");
+    printf("  -s, --stream DEST        write every frame to the file or pipe DEST\n"
+           "                           (- for stdout) instead of anim/ and the GIF\n");
+    printf("      --stream-format FMT  y4m (YUV4MPEG2 4:2:0, default) or rgb (raw RGB24)\n");
+    printf("      --no-hiz             turn off hierarchical z rejection\n");
+    printf("      --no-layers          draw static objects on every frame instead of\n"
+           "                           once in to cached layers\n");
+    printf("      --lod PX             pick the detail of each sphere and torus so\n"
+           "                           its outline is within PX pixels (default: off)\n");
+    exit(1);
+}
+
+/*======== int parse_options() ==========
+  Inputs:   int argc
+            char **argv
+  Returns: The index in argv of the script to run
+
+  Reads the command line options into the render settings
+  ====================*/
+int parse_options(int argc, char **argv) {
+
+    static struct option long_options[] = {
+        {"resolution", required_argument, 0, 'r'},
+        {"preview-scale", required_argument, 0, 'p'},
+        {"threads", required_argument, 0, 't'},
+        {"rasterizer", required_argument, 0, 'R'},
+        {"jobs", required_argument, 0, 'j'},
+        {"writers", required_argument, 0, 'w'},
+        {"frame-format", required_argument, 0, 'f'},
+        {"gif-palette", required_argument, 0, 'P'},
+        {"gif-dither", no_argument, 0, 'D'},
+        {"stream", required_argument, 0, 's'},
+        {"stream-format", required_argument, 0, 'S'},
+        {"no-hiz", no_argument, 0, 'H'},
+        {"no-layers", no_argument, 0, 'C'},
+        {"lod", required_argument, 0, 'L'},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0}
+    };
+    int opt;
+
+    while ((opt = getopt_long(argc, argv, "r:p:t:R:j:w:f:s:h", long_options, NULL)) != -1) {
+        switch (opt) {
+        case 'r':
+            if (sscanf(optarg, "%dx%d", &xres, &yres) != 2 ||
+                xres <= 0 || yres <= 0) {
+                printf("error: bad resolution %s, expected WxH\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'p':
+            preview_scale = atof(optarg);
+            if (preview_scale <= 0) {
+                printf("error: preview scale must be positive\n");
+                exit(1);
+            }
+            break;
+        case 't':
+            raster_threads = atoi(optarg);
+            if (raster_threads < 1) {
+                printf("error: need at least 1 thread\n");
+                exit(1);
+            }
+            break;
+        case 'R':
+            if (!strcmp(optarg, "scanline"))
+                fill_mode = FILL_SCANLINE;
+            else if (!strcmp(optarg, "edge"))
+                fill_mode = FILL_EDGE;
+            else {
+                printf("error: unknown rasterizer %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'j':
+            jobs = atoi(optarg);
+            if (jobs < 1) {
+                printf("error: need at least 1 job\n");
+                exit(1);
+            }
+            break;
+        case 'w':
+            writers = atoi(optarg);
+            if (writers < 1) {
+                printf("error: need at least 1 writer\n");
+                exit(1);
+            }
+            break;
+        case 'f':
+            if (strcmp(optarg, "png") && strcmp(optarg, "ppm") &&
+                strcmp(optarg, "qoi") && strcmp(optarg, "none")) {
+                printf("error: unknown frame format %s\n", optarg);
+                exit(1);
+            }
+            frame_format = optarg;
+            break;
+        case 'P':
+            if (!strcmp(optarg, "local"))
+                gif_palette = GIF_LOCAL;
+            else if (!strcmp(optarg, "global"))
+                gif_palette = GIF_GLOBAL;
+            else {
+                printf("error: unknown GIF palette %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'D':
+            gif_dither = 1;
+            break;
+        case 's':
+            stream_dest = optarg;
+            break;
+        case 'S':
+            if (!strcmp(optarg, "y4m"))
+                stream_format = STREAM_Y4M;
+            else if (!strcmp(optarg, "rgb"))
+                stream_format = STREAM_RGB;
+            else {
+                printf("error: unknown stream format %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'H':
+            use_hiz = 0;
+            break;
+        case 'C':
+            use_layers = 0;
+            break;
+        case 'L':
+            lod_tolerance = atof(optarg);
+            if (lod_tolerance < 0) {
+                printf("error: LOD tolerance must not be negative\n");
+                exit(1);
+            }
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    //meshes are parsed once, while every frame waits for them
+    mesh_threads = raster_threads;
+    if (!mesh_threads) {
+        mesh_threads = sysconf(_SC_NPROCESSORS_ONLN);
+        mesh_threads = mesh_threads > 0 ? mesh_threads : 1;
+    }
+
+    //frames drawn at once already keep the CPUs busy
+    if (!raster_threads && jobs > 1)
+        raster_threads = 1;
+    if (!raster_threads)
+        raster_threads = mesh_threads;
+    png_threads = raster_threads;
+
+    //opened before anything else is printed, in case it is stdout
+    if (stream_dest) {
+        video_out = open_stream(stream_dest, stream_format, 3);
+        if (!video_out) {
+            printf("error: could not open stream %s\n", stream_dest);
+            exit(1);
+        }
+    }
+
+    if (optind >= argc)
+        usage(argv[0]);
+    return optind;
+}
 
 
 /*======== void find_light() ==========
@@ -77,7 +297,7 @@ int find_light() {
   Returns:
 
   Checks the op array for any animation commands
-  (frames, basename, vary)
+  (frames, basename, vary) and for the resolution
 
   Should set num_frames and basename if the frames
   or basename commands are present
@@ -88,6 +308,9 @@ int find_light() {
   If frames is found, but basename is not, set name
   to some default value, and print out a message
   with the name being used.
+
+  resolution only applies if it was not given on the
+  command line. Without either, XRES x YRES is used.
   ====================*/
 void first_pass() {
     //in order to use name and num_frames throughout
@@ -98,6 +321,7 @@ void first_pass() {
     int vary_found = 0;
     int frames_found = 0;
     int name_found = 0;
+    int res_locked = xres != 0;
 
     int i;
     for (i=0;i<lastop;i++) {
@@ -120,6 +344,20 @@ void first_pass() {
                    op[i].op.vary.end_val);
             vary_found = 1;
             break;
+        case RESOLUTION:
+            printf("Resolution: %4.0f %4.0f",
+                   op[i].op.resolution.width,
+                   op[i].op.resolution.height);
+            if (op[i].op.resolution.width < 1 ||
+                op[i].op.resolution.height < 1) {
+                printf("\nResolution must be at least 1x1.\n");
+                exit(1);
+            }
+            if (!res_locked) {
+                xres = op[i].op.resolution.width;
+                yres = op[i].op.resolution.height;
+            }
+            break;
         }
     }
 
@@ -138,6 +376,10 @@ void first_pass() {
         num_frames = 1;
     }
 
+    if (!xres) {
+        xres = XRES;
+        yres = YRES;
+    }
 }
 
 /*======== struct vary_node ** second_pass() ==========
@@ -251,39 +493,278 @@ void reset_constants(double *a, double *d, double *s, double *a_default, double
 }
 
 
-/*======== void my_main() ==========
+/*======== struct stack * new_systems() ==========
   Inputs:
+  Returns: A new coordinate system stack
+
+  The bottom of the stack maps scene coordinates onto the
+  screen. It is the identity unless a preview scale is set,
+  in which case everything is scaled uniformly so the whole
+  scene still fits the smaller screen.
+  ====================*/
+struct stack * new_systems() {
+
+    struct stack *systems = new_stack();
+
+    if (preview_scale != 1)
+        scale_matrix(peek(systems), preview_scale, preview_scale, preview_scale);
+    return systems;
+}
+
+//where a draw op is drawn: on every frame, or just once in
+//to the layer under or over everything drawn on every frame
+#define LAYER_FRAME 0
+#define LAYER_UNDER 1
+#define LAYER_OVER 2
+
+/*
+  What fold_transforms found out about one op. A move, scale
+  or rotate is invariant when the top of the coordinate system
+  stack after it is the same on every frame, which m then
+  holds. skip is set when the op after it is invariant too,
+  so this one's matrix would only be replaced. layer is where
+  a draw op is drawn, set by sort_layers.
+*/
+struct folded_op {
+    int invariant;
+    int skip;
+    int layer;
+    double m[4][4];
+};
+
+//one per op, filled in by fold_transforms
+static struct folded_op *folded = NULL;
+
+/*======== int knob_free() ==========
+  Inputs:   int i
+  Returns: 1 if the move, scale or rotate op[i] comes out the
+  same on every frame
+  ====================*/
+int knob_free(int i) {
+
+    SYMTAB *p;
+
+    if (op[i].opcode == MOVE)
+        p = op[i].op.move.p;
+    else if (op[i].opcode == SCALE)
+        p = op[i].op.scale.p;
+    else
+        p = op[i].op.rotate.p;
+    //knobs are only looked up in animations
+    return !p || num_frames == 1;
+}
+
+/*======== int draw_op() ==========
+  Inputs:   int opcode
+  Returns: 1 if ops with this opcode draw something
+  ====================*/
+int draw_op(int opcode) {
+    return opcode == SPHERE || opcode == TORUS || opcode == BOX ||
+        opcode == LINE || opcode == MESH;
+}
+
+/*======== void fold_transforms() ==========
+  Inputs:
+  Returns: The number of transforms folded
+
+  Runs the transforms of op once before any frame is drawn,
+  the way draw_frame does, following push and pop, until a
+  transform with a knob makes a level of the stack depend on
+  the frame. Each transform before that point is marked
+  invariant in folded, along with the matrix it leaves on top
+  of the stack. draw_frame then copies in the matrix at the
+  end of each run of invariant transforms instead of redoing
+  the run. As it is the same matrix worked out the same way,
+  the images do not change.
+
+  Draw ops made while the top of the stack is still invariant
+  are put in LAYER_UNDER for sort_layers to look at, the rest
+  in LAYER_FRAME.
+  ====================*/
+int fold_transforms() {
+
+    struct stack *systems = new_systems();
+    struct matrix *top;
+    char invariant[STACK_SIZE];
+    int i, r, num_folded = 0;
+
+    folded = (struct folded_op *)calloc(lastop + 1, sizeof(struct folded_op));
+    invariant[0] = 1;
+    for (i = 0; i < lastop; i++) {
+        switch (op[i].opcode) {
+        case PUSH:
+            push(systems);
+            invariant[systems->top] = invariant[systems->top - 1];
+            break;
+        case POP:
+            pop(systems);
+            break;
+        case MOVE:
+        case SCALE:
+        case ROTATE:
+            if (!invariant[systems->top] || !knob_free(i)) {
+                invariant[systems->top] = 0;
+                break;
+            }
+            top = peek(systems);
+            if (op[i].opcode == MOVE)
+                translate_matrix(top, op[i].op.move.d[0], op[i].op.move.d[1],
+                                 op[i].op.move.d[2]);
+            else if (op[i].opcode == SCALE)
+                scale_matrix(top, op[i].op.scale.d[0], op[i].op.scale.d[1],
+                             op[i].op.scale.d[2]);
+            else
+                rotate_matrix(top, op[i].op.rotate.axis,
+                              op[i].op.rotate.degrees * (M_PI / 180));
+            for (r = 0; r < 4; r++)
+                memcpy(folded[i].m[r], top->m[r], sizeof(folded[i].m[r]));
+            folded[i].invariant = 1;
+            num_folded++;
+            break;
+        default:
+            if (draw_op(op[i].opcode) && invariant[systems->top])
+                folded[i].layer = LAYER_UNDER;
+        }
+    }
+    for (i = 0; i + 1 < lastop; i++)
+        folded[i].skip = folded[i].invariant && folded[i + 1].invariant;
+
+    free_stack(systems);
+    return num_folded;
+}
+
+/*======== void sort_layers() ==========
+  Inputs:   int *under
+            int *over
   Returns:
 
-  This is the main engine of the interpreter, it should
-  handle most of the commadns in mdl.
+  Picks which of the draw ops fold_transforms found to be the
+  same on every frame are drawn just once, in to a cached
+  layer, and sets under and over to how many there are in
+  each layer.
+
+  Where depths are equal, the last thing drawn wins. So only
+  the static draw ops before the first one that moves can go
+  under the others, and only those after the last one that
+  moves can go over them. Static draw ops in between are
+  still drawn on every frame. Layers are only used in
+  animations, and not at all when the script saves or
+  displays images part way through a frame.
+  ====================*/
+void sort_layers(int *under, int *over) {
+
+    int i, first, last, saves = 0;
+
+    first = lastop;
+    last = -1;
+    for (i = 0; i < lastop; i++) {
+        if (op[i].opcode == SAVE || op[i].opcode == DISPLAY)
+            saves = 1;
+        else if (draw_op(op[i].opcode) && folded[i].layer == LAYER_FRAME) {
+            first = first < i ? first : i;
+            last = i;
+        }
+    }
 
-  If frames is not present in the source (and therefore
-  num_frames is 1, then process_knobs should be called.
+    *under = *over = 0;
+    for (i = 0; i < lastop; i++) {
+        if (folded[i].layer == LAYER_FRAME)
+            continue;
+        if (num_frames == 1 || !use_layers || saves)
+            folded[i].layer = LAYER_FRAME;
+        else if (i < first)
+            (*under)++;
+        else if (i > last) {
+            folded[i].layer = LAYER_OVER;
+            (*over)++;
+        }
+        else
+            folded[i].layer = LAYER_FRAME;
+    }
+}
 
-  If frames is present, the enitre op array must be
-  applied frames time. At the end of each frame iteration
-  save the current screen to a file named the
-  provided basename plus a numeric string such that the
-  files will be listed in order, then clear the screen and
-  reset any other data structures that need it.
+/*======== int load_folded() ==========
+  Inputs:   int i
+            struct stack *systems
+  Returns: 1 if op[i] was folded, 0 if it still has to be done
 
-  Important note: you cannot just name your files in
-  regular sequence, like pic0, pic1, pic2, pic3... if that
-  is done, then pic1, pic10, pic11... will come before pic2
-  and so on. In order to keep things clear, add leading 0s
-  to the numeric portion of the name. If you use sprintf,
-  you can use "%0xd" for this purpose. It will add at most
-  x 0s in front of a number, if needed, so if used correctly,
-  and x = 4, you would get numbers like 0001, 0002, 0011,
-  0487
+  Puts the matrix fold_transforms worked out for op[i] on top
+  of systems, unless the next op replaces it anyway
   ====================*/
-void my_main() {
+int load_folded(int i, struct stack *systems) {
+
+    struct matrix *top;
+    int r;
+
+    if (!folded[i].invariant)
+        return 0;
+    if (!folded[i].skip) {
+        top = peek(systems);
+        for (r = 0; r < 4; r++)
+            memcpy(top->m[r], folded[i].m[r], sizeof(folded[i].m[r]));
+    }
+    return 1;
+}
+
+/*======== int off_screen() ==========
+  Inputs:   screen t
+            struct stack *systems
+            double x0, y0, z0
+            double x1, y1, z1
+  Returns: 1 if nothing inside the box with opposite corners
+           (x0, y0, z0) and (x1, y1, z1) can land on t once
+           moved by the top of systems
+  ====================*/
+int off_screen(screen t, struct stack *systems,
+               double x0, double y0, double z0,
+               double x1, double y1, double z1) {
+
+    double lo[3], hi[3];
+
+    lo[0] = fmin(x0, x1);
+    lo[1] = fmin(y0, y1);
+    lo[2] = fmin(z0, z1);
+    hi[0] = fmax(x0, x1);
+    hi[1] = fmax(y0, y1);
+    hi[2] = fmax(z0, z1);
+    return outside_clip_box(t, peek(systems), lo, hi);
+}
+
+/*======== int draw_frame() ==========
+  Inputs:   int frame
+            struct vary_node **knobs
+            screen t
+            zbuffer zb
+            struct output_queue *out
+            int verbose
+            int *objects
+            int layer
+  Returns: how many of the objects were culled
+
+  Runs every command in op once, drawing the given frame of
+  the animation to t. The coordinate system stack, lights and
+  everything else the commands change live in here, while op,
+  the symbol table and knobs are only read, so different frames
+  can be drawn at the same time on different screens.
+
+  Images saved along the way are written by out.
+  Commands are only echoed if verbose is set.
+
+  Spheres, tori, boxes and meshes whose bounding boxes end up
+  off the screen are skipped before any of their points are
+  made. objects is set to how many there were in all.
+
+  Only the draw ops sort_layers put in layer are drawn, though
+  everything else is still run.
+  ====================*/
+int draw_frame(int frame, struct vary_node **knobs,
+               screen t, zbuffer zb, struct output_queue *out, int verbose,
+               int *objects, int layer) {
 
     struct matrix *tmp;
+    //where the unit sphere or torus in tmp goes
+    struct matrix *instance;
     struct stack *systems;
-    screen t;
-    zbuffer zb;
     color g;
     g.red = 0;
     g.green = 0;
@@ -295,6 +776,7 @@ void my_main() {
     //Lighting values here for easy access
     struct constants *c;
     struct light *lights[MAX_LIGHTS];
+    struct light default_light;
     int num_lights;
     int current_light;
     color ambient;
@@ -303,6 +785,13 @@ void my_main() {
     double dreflect[3];  // default
     double sreflect[3];  // default
     double a[3], d[3], s[3];
+    //object space normals of the last mesh loaded
+    struct normals mesh_normals = {0};
+    //triangles of the sphere, torus or mesh in tmp
+    struct triangles tris = {0};
+    //mesh the current MESH command draws
+    struct mesh *mesh;
+    int culled = 0;
 
     ambient.red = 50;
     ambient.green = 50;
@@ -324,13 +813,11 @@ void my_main() {
     sreflect[GREEN] = 0.5;
     sreflect[BLUE] = 0.5;
 
-    c = (struct constants *)malloc(sizeof(struct constants));
-
     num_lights = find_light();
     current_light = 0;
 
     if (num_lights == 0) {
-        lights[0] = (struct light *)malloc(sizeof(struct light));
+        lights[0] = &default_light;
 
         lights[0]->l[0] = 0.5;
         lights[0]->l[1] = 0.75;
@@ -343,292 +830,553 @@ void my_main() {
         num_lights = 1;
     }
 
-    systems = new_stack();
+    systems = new_systems();
     tmp = new_matrix(4, 1000);
-    clear_screen( t );
-    clear_zbuffer(zb);
-
-    first_pass();
-    struct vary_node **knobs = second_pass();
+    instance = new_matrix(4, 4);
 
-    int frame;
-    for (frame = 0; frame < num_frames; frame++) {
-        printf("Frame: %d\n", frame);
-
-        if (num_frames > 1) {
-            struct vary_node * node = knobs[frame];
-
-            while(node){
-                set_value(lookup_symbol(node->name), node->value);
-                node = node->next;
-            }
-        }
-
-        int i;
-        for (i=0;i<lastop;i++) {
-            //printf("%d: ",i);
-
-            switch (op[i].opcode)
-                {
-                case SPHERE:
-                    /* printf("Sphere: %6.2f %6.2f %6.2f r=%6.2f", */
-                    /* 	 op[i].op.sphere.d[0],op[i].op.sphere.d[1], */
-                    /* 	 op[i].op.sphere.d[2], */
-                    /* 	 op[i].op.sphere.r); */
-                    reset_constants(a, d, s, areflect, dreflect, sreflect);
-                    if (op[i].op.sphere.constants != NULL)
-                        {
-                            //printf("\tconstants: %s",op[i].op.sphere.constants->name);
-                            c = lookup_symbol(op[i].op.sphere.constants->name)->s.c;
-                            set_constants(c, a, d, s);
-                        }
-                    if (op[i].op.sphere.cs != NULL)
-                        {
-                            //printf("\tcs: %s",op[i].op.sphere.cs->name);
-                        }
-                    add_sphere(tmp, op[i].op.sphere.d[0],
-                               op[i].op.sphere.d[1],
-                               op[i].op.sphere.d[2],
-                               op[i].op.sphere.r, step_3d);
-                    matrix_mult( peek(systems), tmp );
-                    draw_polygons(tmp, t, zb, view, lights, num_lights, ambient,
-                                  a, d, s);
-                    tmp->lastcol = 0;
-                    break;
-                case TORUS:
-                    /* printf("Torus: %6.2f %6.2f %6.2f r0=%6.2f r1=%6.2f", */
-                    /* 	 op[i].op.torus.d[0],op[i].op.torus.d[1], */
-                    /* 	 op[i].op.torus.d[2], */
-                    /* 	 op[i].op.torus.r0,op[i].op.torus.r1); */
-                    reset_constants(a, d, s, areflect, dreflect, sreflect);
-                    if (op[i].op.torus.constants != NULL)
-                        {
-                            //printf("\tconstants: %s",op[i].op.torus.constants->name);
-                            c = lookup_symbol(op[i].op.torus.constants->name)->s.c;
-                            set_constants(c, a, d, s);
-                        }
-                    if (op[i].op.torus.cs != NULL)
-                        {
-                            //printf("\tcs: %s",op[i].op.torus.cs->name);
-                        }
-                    add_torus(tmp,
-                              op[i].op.torus.d[0],
-                              op[i].op.torus.d[1],
-                              op[i].op.torus.d[2],
-                              op[i].op.torus.r0,op[i].op.torus.r1, step_3d);
-                    matrix_mult( peek(systems), tmp );
-                    draw_polygons(tmp, t, zb, view, lights, num_lights, ambient,
-                                  a, d, s);
-                    tmp->lastcol = 0;
+    int i;
+    for (i=0;i<lastop;i++) {
+        //printf("%d: ",i);
+
+        if (draw_op(op[i].opcode) && folded[i].layer != layer)
+            continue;
+
+        switch (op[i].opcode)
+            {
+            case SPHERE:
+                /* printf("Sphere: %6.2f %6.2f %6.2f r=%6.2f", */
+                /* 	 op[i].op.sphere.d[0],op[i].op.sphere.d[1], */
+                /* 	 op[i].op.sphere.d[2], */
+                /* 	 op[i].op.sphere.r); */
+                reset_constants(a, d, s, areflect, dreflect, sreflect);
+                if (op[i].op.sphere.constants != NULL)
+                    {
+                        //printf("\tconstants: %s",op[i].op.sphere.constants->name);
+                        c = lookup_symbol(op[i].op.sphere.constants->name)->s.c;
+                        set_constants(c, a, d, s);
+                    }
+                if (op[i].op.sphere.cs != NULL)
+                    {
+                        //printf("\tcs: %s",op[i].op.sphere.cs->name);
+                    }
+                (*objects)++;
+                if (off_screen(t, systems,
+                               op[i].op.sphere.d[0] - op[i].op.sphere.r,
+                               op[i].op.sphere.d[1] - op[i].op.sphere.r,
+                               op[i].op.sphere.d[2] - op[i].op.sphere.r,
+                               op[i].op.sphere.d[0] + op[i].op.sphere.r,
+                               op[i].op.sphere.d[1] + op[i].op.sphere.r,
+                               op[i].op.sphere.d[2] + op[i].op.sphere.r)) {
+                    culled++;
                     break;
-                case BOX:
-                    /* printf("Box: d0: %6.2f %6.2f %6.2f d1: %6.2f %6.2f %6.2f", */
-                    /* 	 op[i].op.box.d0[0],op[i].op.box.d0[1], */
-                    /* 	 op[i].op.box.d0[2], */
-                    /* 	 op[i].op.box.d1[0],op[i].op.box.d1[1], */
-                    /* 	 op[i].op.box.d1[2]); */
-                    reset_constants(a, d, s, areflect, dreflect, sreflect);
-                    if (op[i].op.box.constants != NULL)
-                        {
-                            //printf("\tconstants: %s",op[i].op.box.constants->name);
-                            c = lookup_symbol(op[i].op.box.constants->name)->s.c;
-                            set_constants(c, a, d, s);
-                        }
-                    if (op[i].op.box.cs != NULL)
-                        {
-                            //printf("\tcs: %s",op[i].op.box.cs->name);
-                        }
-                    add_box(tmp,
-                            op[i].op.box.d0[0],op[i].op.box.d0[1],
-                            op[i].op.box.d0[2],
-                            op[i].op.box.d1[0],op[i].op.box.d1[1],
-                            op[i].op.box.d1[2]);
-                    matrix_mult( peek(systems), tmp );
-                    draw_polygons(tmp, t, zb, view, lights, num_lights, ambient,
-                                  a, d, s);
-                    tmp->lastcol = 0;
+                }
+                copy_matrix(peek(systems), instance);
+                add_sphere(tmp, &tris, instance, op[i].op.sphere.d[0],
+                           op[i].op.sphere.d[1],
+                           op[i].op.sphere.d[2],
+                           op[i].op.sphere.r,
+                           lod_step(peek(systems), op[i].op.sphere.r,
+                                    lod_tolerance, step_3d));
+                matrix_mult( instance, tmp );
+                draw_triangles(tmp, &tris, NULL, t, zb, view, lights, num_lights, ambient,
+                               a, d, s);
+                tmp->lastcol = 0;
+                tris.count = 0;
+                break;
+            case TORUS:
+                /* printf("Torus: %6.2f %6.2f %6.2f r0=%6.2f r1=%6.2f", */
+                /* 	 op[i].op.torus.d[0],op[i].op.torus.d[1], */
+                /* 	 op[i].op.torus.d[2], */
+                /* 	 op[i].op.torus.r0,op[i].op.torus.r1); */
+                reset_constants(a, d, s, areflect, dreflect, sreflect);
+                if (op[i].op.torus.constants != NULL)
+                    {
+                        //printf("\tconstants: %s",op[i].op.torus.constants->name);
+                        c = lookup_symbol(op[i].op.torus.constants->name)->s.c;
+                        set_constants(c, a, d, s);
+                    }
+                if (op[i].op.torus.cs != NULL)
+                    {
+                        //printf("\tcs: %s",op[i].op.torus.cs->name);
+                    }
+                //the ring lies flat in the xz plane
+                xval = fabs(op[i].op.torus.r0) + fabs(op[i].op.torus.r1);
+                yval = fabs(op[i].op.torus.r0);
+                (*objects)++;
+                if (off_screen(t, systems,
+                               op[i].op.torus.d[0] - xval,
+                               op[i].op.torus.d[1] - yval,
+                               op[i].op.torus.d[2] - xval,
+                               op[i].op.torus.d[0] + xval,
+                               op[i].op.torus.d[1] + yval,
+                               op[i].op.torus.d[2] + xval)) {
+                    culled++;
                     break;
-                case LINE:
-                    /* printf("Line: from: %6.2f %6.2f %6.2f to: %6.2f %6.2f %6.2f",*/
-                    /* 	 op[i].op.line.p0[0],op[i].op.line.p0[1], */
-                    /* 	 op[i].op.line.p0[1], */
-                    /* 	 op[i].op.line.p1[0],op[i].op.line.p1[1], */
-                    /* 	 op[i].op.line.p1[1]); */
-                    reset_constants(a, d, s, areflect, dreflect, sreflect);
-                    if (op[i].op.line.constants != NULL)
-                        {
-                            //printf("\n\tConstants: %s",op[i].op.line.constants->name);
-                            c = lookup_symbol(op[i].op.line.constants->name)->s.c;
-                            set_constants(c, a, d, s);
-                        }
-                    if (op[i].op.line.cs0 != NULL)
-                        {
-                            //printf("\n\tCS0: %s",op[i].op.line.cs0->name);
-                        }
-                    if (op[i].op.line.cs1 != NULL)
-                        {
-                            //printf("\n\tCS1: %s",op[i].op.line.cs1->name);
-                        }
-                    add_edge(tmp,
-                             op[i].op.line.p0[0],op[i].op.line.p0[1],
-                             op[i].op.line.p0[2],
-                             op[i].op.line.p1[0],op[i].op.line.p1[1],
-                             op[i].op.line.p1[2]);
-                    matrix_mult( peek(systems), tmp );
-                    draw_lines(tmp, t, zb, g);
-                    tmp->lastcol = 0;
+                }
+                copy_matrix(peek(systems), instance);
+                add_torus(tmp, &tris, instance,
+                          op[i].op.torus.d[0],
+                          op[i].op.torus.d[1],
+                          op[i].op.torus.d[2],
+                          op[i].op.torus.r0,op[i].op.torus.r1,
+                          lod_step(peek(systems),
+                                   fabs(op[i].op.torus.r0) + fabs(op[i].op.torus.r1),
+                                   lod_tolerance, step_3d));
+                matrix_mult( instance, tmp );
+                draw_triangles(tmp, &tris, NULL, t, zb, view, lights, num_lights, ambient,
+                               a, d, s);
+                tmp->lastcol = 0;
+                tris.count = 0;
+                break;
+            case BOX:
+                /* printf("Box: d0: %6.2f %6.2f %6.2f d1: %6.2f %6.2f %6.2f", */
+                /* 	 op[i].op.box.d0[0],op[i].op.box.d0[1], */
+                /* 	 op[i].op.box.d0[2], */
+                /* 	 op[i].op.box.d1[0],op[i].op.box.d1[1], */
+                /* 	 op[i].op.box.d1[2]); */
+                reset_constants(a, d, s, areflect, dreflect, sreflect);
+                if (op[i].op.box.constants != NULL)
+                    {
+                        //printf("\tconstants: %s",op[i].op.box.constants->name);
+                        c = lookup_symbol(op[i].op.box.constants->name)->s.c;
+                        set_constants(c, a, d, s);
+                    }
+                if (op[i].op.box.cs != NULL)
+                    {
+                        //printf("\tcs: %s",op[i].op.box.cs->name);
+                    }
+                (*objects)++;
+                if (off_screen(t, systems,
+                               op[i].op.box.d0[0], op[i].op.box.d0[1],
+                               op[i].op.box.d0[2],
+                               op[i].op.box.d0[0] + op[i].op.box.d1[0],
+                               op[i].op.box.d0[1] - op[i].op.box.d1[1],
+                               op[i].op.box.d0[2] - op[i].op.box.d1[2])) {
+                    culled++;
                     break;
-                case MOVE:
-                    xval = op[i].op.move.d[0];
-                    yval = op[i].op.move.d[1];
-                    zval = op[i].op.move.d[2];
-
-                    if (op[i].op.move.p != NULL)
-                        {
+                }
+                add_box(tmp,
+                        op[i].op.box.d0[0],op[i].op.box.d0[1],
+                        op[i].op.box.d0[2],
+                        op[i].op.box.d1[0],op[i].op.box.d1[1],
+                        op[i].op.box.d1[2]);
+                matrix_mult( peek(systems), tmp );
+                draw_polygons(tmp, NULL, t, zb, view, lights, num_lights, ambient,
+                              a, d, s);
+                tmp->lastcol = 0;
+                break;
+            case LINE:
+                /* printf("Line: from: %6.2f %6.2f %6.2f to: %6.2f %6.2f %6.2f",*/
+                /* 	 op[i].op.line.p0[0],op[i].op.line.p0[1], */
+                /* 	 op[i].op.line.p0[1], */
+                /* 	 op[i].op.line.p1[0],op[i].op.line.p1[1], */
+                /* 	 op[i].op.line.p1[1]); */
+                reset_constants(a, d, s, areflect, dreflect, sreflect);
+                if (op[i].op.line.constants != NULL)
+                    {
+                        //printf("\n\tConstants: %s",op[i].op.line.constants->name);
+                        c = lookup_symbol(op[i].op.line.constants->name)->s.c;
+                        set_constants(c, a, d, s);
+                    }
+                if (op[i].op.line.cs0 != NULL)
+                    {
+                        //printf("\n\tCS0: %s",op[i].op.line.cs0->name);
+                    }
+                if (op[i].op.line.cs1 != NULL)
+                    {
+                        //printf("\n\tCS1: %s",op[i].op.line.cs1->name);
+                    }
+                add_edge(tmp,
+                         op[i].op.line.p0[0],op[i].op.line.p0[1],
+                         op[i].op.line.p0[2],
+                         op[i].op.line.p1[0],op[i].op.line.p1[1],
+                         op[i].op.line.p1[2]);
+                matrix_mult( peek(systems), tmp );
+                draw_lines(tmp, t, zb, g);
+                tmp->lastcol = 0;
+                break;
+            case MOVE:
+                xval = op[i].op.move.d[0];
+                yval = op[i].op.move.d[1];
+                zval = op[i].op.move.d[2];
+
+                if (op[i].op.move.p != NULL)
+                    {
+                        if (verbose)
                             printf("\tknob: %s",op[i].op.move.p->name);
-                            if (num_frames > 1) {
-                                struct vary_node *knob = knobs[frame];
-                                while(strcmp(knob->name, op[i].op.move.p->name) && knob){
-                                    knob = knob->next;
-                                }
-                                knob_value = knob->value;
-                                xval *= knob_value;
-                                yval *= knob_value;
-                                zval *= knob_value;
+                        if (num_frames > 1) {
+                            struct vary_node *knob = knobs[frame];
+                            while(strcmp(knob->name, op[i].op.move.p->name) && knob){
+                                knob = knob->next;
                             }
+                            knob_value = knob->value;
+                            xval *= knob_value;
+                            yval *= knob_value;
+                            zval *= knob_value;
                         }
+                    }
+                if (verbose)
                     printf("Move: %6.2f %6.2f %6.2f",
                            xval, yval, zval);
 
-                    tmp = make_translate( xval, yval, zval );
-                    matrix_mult(peek(systems), tmp);
-                    copy_matrix(tmp, peek(systems));
-                    tmp->lastcol = 0;
-                    break;
-                case SCALE:
-                    xval = op[i].op.scale.d[0];
-                    yval = op[i].op.scale.d[1];
-                    zval = op[i].op.scale.d[2];
-
-                    if (op[i].op.scale.p != NULL)
-                        {
+                if (!load_folded(i, systems))
+                    translate_matrix(peek(systems), xval, yval, zval);
+                break;
+            case SCALE:
+                xval = op[i].op.scale.d[0];
+                yval = op[i].op.scale.d[1];
+                zval = op[i].op.scale.d[2];
+
+                if (op[i].op.scale.p != NULL)
+                    {
+                        if (verbose)
                             printf("\tknob: %s",op[i].op.scale.p->name);
-                            if (num_frames > 1) {
-                                struct vary_node *knob = knobs[frame];
-                                while(strcmp(knob->name, op[i].op.scale.p->name) && knob){
-                                    knob = knob->next;
-                                }
-
-                                knob_value = knob->value;
-                                xval *= knob_value;
-                                yval *= knob_value;
-                                zval *= knob_value;
+                        if (num_frames > 1) {
+                            struct vary_node *knob = knobs[frame];
+                            while(strcmp(knob->name, op[i].op.scale.p->name) && knob){
+                                knob = knob->next;
                             }
+
+                            knob_value = knob->value;
+                            xval *= knob_value;
+                            yval *= knob_value;
+                            zval *= knob_value;
                         }
+                    }
+                if (verbose)
                     printf("Scale: %6.2f %6.2f %6.2f",
                            xval, yval, zval);
 
-                    tmp = make_scale( xval, yval, zval );
-                    matrix_mult(peek(systems), tmp);
-                    copy_matrix(tmp, peek(systems));
-                    tmp->lastcol = 0;
-                    break;
-                case ROTATE:
-                    xval = op[i].op.rotate.axis;
-                    theta = op[i].op.rotate.degrees;
+                if (!load_folded(i, systems))
+                    scale_matrix(peek(systems), xval, yval, zval);
+                break;
+            case ROTATE:
+                xval = op[i].op.rotate.axis;
+                theta = op[i].op.rotate.degrees;
 
-                    if (op[i].op.rotate.p != NULL)
-                        {
+                if (op[i].op.rotate.p != NULL)
+                    {
+                        if (verbose)
                             printf("\tknob: %s",op[i].op.rotate.p->name);
-                            if (num_frames > 1) {
-                                struct vary_node *knob = knobs[frame];
-                                while(strcmp(knob->name, op[i].op.rotate.p->name) && knob){
-                                    knob = knob->next;
-                                }
-
-                                knob_value = knob->value;
-                                theta *= knob_value;
+                        if (num_frames > 1) {
+                            struct vary_node *knob = knobs[frame];
+                            while(strcmp(knob->name, op[i].op.rotate.p->name) && knob){
+                                knob = knob->next;
                             }
+
+                            knob_value = knob->value;
+                            theta *= knob_value;
                         }
+                    }
+                if (verbose)
                     printf("Rotate: axis: %6.2f degrees: %6.2f",
                            xval, theta);
 
-                    theta*= (M_PI / 180);
-                    if (op[i].op.rotate.axis == 0 )
-                        tmp = make_rotX( theta );
-                    else if (op[i].op.rotate.axis == 1 )
-                        tmp = make_rotY( theta );
-                    else
-                        tmp = make_rotZ( theta );
-
-                    matrix_mult(peek(systems), tmp);
-                    copy_matrix(tmp, peek(systems));
-                    tmp->lastcol = 0;
-                    break;
-                case PUSH:
-                    //printf("Push");
-                    push(systems);
-                    break;
-                case POP:
-                    //printf("Pop");
-                    pop(systems);
-                    break;
-                case AMBIENT:
-                    ambient.red = op[i].op.ambient.c[0];
-                    ambient.green = op[i].op.ambient.c[1];
-                    ambient.blue = op[i].op.ambient.c[2];
-                    break;
-                case LIGHT:
-                    if (current_light < num_lights) {
-                        struct light *l = (struct light *)malloc(sizeof(struct light));
-                        l = lookup_symbol(op[i].op.light.p->name)->s.l;
-                        lights[current_light] = l;
-                        current_light++;
+                theta*= (M_PI / 180);
+                if (!load_folded(i, systems))
+                    rotate_matrix(peek(systems), op[i].op.rotate.axis, theta);
+                break;
+            case PUSH:
+                //printf("Push");
+                push(systems);
+                break;
+            case POP:
+                //printf("Pop");
+                pop(systems);
+                break;
+            case AMBIENT:
+                ambient.red = op[i].op.ambient.c[0];
+                ambient.green = op[i].op.ambient.c[1];
+                ambient.blue = op[i].op.ambient.c[2];
+                break;
+            case LIGHT:
+                if (current_light < num_lights) {
+                    lights[current_light] = lookup_symbol(op[i].op.light.p->name)->s.l;
+                    current_light++;
+                }
+                break;
+            case CONSTANTS:
+                break;
+            case MESH:
+                reset_constants(a, d, s, areflect, dreflect, sreflect);
+                if (op[i].op.mesh.constants != NULL)
+                    {
+                        //printf("\n\tConstants: %s",op[i].op.line.constants->name);
+                        c = lookup_symbol(op[i].op.mesh.constants->name)->s.c;
+                        set_constants(c, a, d, s);
                     }
+                mesh = load_mesh(op[i].op.mesh.name);
+                (*objects)++;
+                if (off_screen(t, systems,
+                               mesh->bounds[0][0], mesh->bounds[0][1],
+                               mesh->bounds[0][2], mesh->bounds[1][0],
+                               mesh->bounds[1][1], mesh->bounds[1][2])) {
+                    culled++;
                     break;
-                case CONSTANTS:
-                    break;
-                case MESH:
-                    reset_constants(a, d, s, areflect, dreflect, sreflect);
-                    if (op[i].op.mesh.constants != NULL)
-                        {
-                            //printf("\n\tConstants: %s",op[i].op.line.constants->name);
-                            c = lookup_symbol(op[i].op.mesh.constants->name)->s.c;
-                            set_constants(c, a, d, s);
-                        }
-                    tmp = parse_mesh(op[i].op.mesh.name);
-                    matrix_mult(peek(systems), tmp);
-                    draw_polygons(tmp, t, zb, view, lights, num_lights, ambient,
-                                  a, d, s);
-                    tmp->lastcol = 0;
-                    break;
-                case SAVE:
-                    //printf("Save: %s",op[i].op.save.p->name);
-                    save_extension(t, op[i].op.save.p->name);
-                    break;
-                case DISPLAY:
-                    //printf("Display");
-                    display(t);
-                    break;
-                } //end opcode switch
+                }
+                copy_mesh(mesh, tmp, &tris, &mesh_normals);
+                matrix_mult(peek(systems), tmp);
+                transform_normals(peek(systems), &mesh_normals);
+                draw_triangles(tmp, &tris, &mesh_normals, t, zb, view, lights, num_lights,
+                               ambient, a, d, s);
+                tmp->lastcol = 0;
+                tris.count = 0;
+                break;
+            case SAVE:
+                //printf("Save: %s",op[i].op.save.p->name);
+                flush_bins(t, zb);
+                output_copy(out, t, op[i].op.save.p->name);
+                break;
+            case DISPLAY:
+                //printf("Display");
+                flush_bins(t, zb);
+                display(t);
+                break;
+            } //end opcode switch
+        if (verbose)
             printf("\n");
-        }//end operation loop
-
-        if (num_frames > 1) {
-            char pic_name[128];
-            sprintf(pic_name, "anim/%s%03d.png", name, frame);
-            save_extension(t, pic_name);
-            systems = new_stack();
-            tmp = new_matrix(4, 1000);
+    }//end operation loop
+
+    flush_bins(t, zb);
+    free_normals(&mesh_normals);
+    free_triangles(&tris);
+    free_matrix(tmp);
+    free_matrix(instance);
+    free_stack(systems);
+    return culled;
+}
+
+/*
+  Frames of an animation waiting to be drawn, shared by the
+  threads drawing them
+*/
+struct frame_queue {
+    struct vary_node **knobs;
+    struct output_queue *out;
+    int width, height;
+    int verbose;
+    int next_frame;
+    //static layers, NULL when there is nothing in them
+    screen under, over;
+    zbuffer under_zb, over_zb;
+};
+
+/*======== void *draw_frames() ==========
+  Inputs:   void *arg
+  Returns: NULL
+
+  Thread body for --jobs. Draws frames of the animation on a
+  screen and zbuffer of its own until none are left, each
+  one between copies of the static layers, if there are any. Each one
+  is queued for the video stream if there is one. Otherwise,
+  if there is more than one frame, it is queued to be added
+  to the GIF and saved to anim/ (unless the frame format is
+  none).
+  ====================*/
+void *draw_frames(void *arg) {
+
+    struct frame_queue *q = (struct frame_queue *)arg;
+    struct vary_node *node;
+    char pic_name[128];
+    long hiz_triangles, hiz_pixels;
+    screen t;
+    zbuffer zb;
+    int frame, culled, objects;
+
+    t = new_screen(q->width, q->height);
+    zb = new_zbuffer(q->width, q->height);
+    if (raster_threads > 1)
+        enable_binning(t, raster_threads);
+    if (use_hiz)
+        enable_hiz(zb);
+
+    while ((frame = __sync_fetch_and_add(&q->next_frame, 1)) < num_frames) {
+        if (q->under)
+            copy_layer(t, zb, q->under, q->under_zb);
+        else {
             clear_screen(t);
             clear_zbuffer(zb);
         }
+        if (q->verbose) {
+            printf("Frame: %d\n", frame);
+
+            //only the symbol table of a lone drawing thread
+            //can follow the frame it is on
+            if (num_frames > 1)
+                for (node = q->knobs[frame]; node; node = node->next)
+                    set_value(lookup_symbol(node->name), node->value);
+        }
 
+        objects = 0;
+        culled = draw_frame(frame, q->knobs, t, zb, q->out, q->verbose, &objects,
+                            LAYER_FRAME);
+        if (q->over)
+            overlay_layer(t, zb, q->over, q->over_zb);
+        if (culled)
+            printf("Frame %d: culled %d of %d objects\n", frame, culled, objects);
+
+        if (use_hiz) {
+            hiz_stats(zb, &hiz_triangles, &hiz_pixels);
+            printf("Frame %d: HiZ rejected %ld triangles, %ld pixels\n",
+                   frame, hiz_triangles, hiz_pixels);
+        }
+        if (q->out->stream)
+            output_frame(q->out, t, NULL, frame);
+        else if (num_frames > 1) {
+            sprintf(pic_name, "anim/%s%03d.%s", name, frame, frame_format);
+            output_frame(q->out, t, strcmp(frame_format, "none") ? pic_name : NULL,
+                         frame);
+        }
     }
 
-    if (num_frames > 1) {
-        make_animation(name);
+    free_screen(t);
+    free_zbuffer(zb);
+    return NULL;
+}
+
+/*======== void draw_layer() ==========
+  Inputs:   struct frame_queue *q
+            int layer
+            screen *s
+            zbuffer *zb
+  Returns:
+
+  Draws the draw ops in layer once, on a new screen and
+  zbuffer the size of the frames, and points s and zb at them
+  ====================*/
+void draw_layer(struct frame_queue *q, int layer, screen *s, zbuffer *zb) {
+
+    int objects = 0;
+
+    *s = new_screen(q->width, q->height);
+    *zb = new_zbuffer(q->width, q->height);
+    if (raster_threads > 1)
+        enable_binning(*s, raster_threads);
+    if (use_hiz)
+        enable_hiz(*zb);
+    clear_screen(*s);
+    clear_zbuffer(*zb);
+    draw_frame(0, q->knobs, *s, *zb, q->out, 0, &objects, layer);
+    disable_binning(*s);
+    disable_hiz(*zb);
+}
+
+/*======== void my_main() ==========
+  Inputs:
+  Returns:
+
+  This is the main engine of the interpreter, it should
+  handle most of the commadns in mdl.
+
+  If frames is not present in the source (and therefore
+  num_frames is 1, then process_knobs should be called.
+
+  If frames is present, the enitre op array must be
+  applied frames time. At the end of each frame iteration
+  save the current screen to a file named the
+  provided basename plus a numeric string such that the
+  files will be listed in order, then clear the screen and
+  reset any other data structures that need it.
+
+  Important note: you cannot just name your files in
+  regular sequence, like pic0, pic1, pic2, pic3... if that
+  is done, then pic1, pic10, pic11... will come before pic2
+  and so on. In order to keep things clear, add leading 0s
+  to the numeric portion of the name. If you use sprintf,
+  you can use "%0xd" for this purpose. It will add at most
+  x 0s in front of a number, if needed, so if used correctly,
+  and x = 4, you would get numbers like 0001, 0002, 0011,
+  0487
+
+  With --jobs, frames are handed out to that many threads
+  (this one included) as they finish their last one. Images
+  are written by --writers more threads in the background,
+  which also add each frame to the GIF as it comes in, so the
+  animation is done once they have all been flushed.
+  ====================*/
+void my_main() {
+
+    struct frame_queue q;
+    struct gif_writer *gif = NULL;
+    char gif_name[256];
+    pthread_t *threads;
+    long mesh_hits, mesh_misses, mesh_bytes;
+    int k, num_jobs, num_folded, num_under, num_over;
+
+    first_pass();
+    q.knobs = second_pass();
+    num_folded = fold_transforms();
+    sort_layers(&num_under, &num_over);
+
+    q.width = xres * preview_scale + 0.5;
+    q.height = yres * preview_scale + 0.5;
+    q.width = q.width > 0 ? q.width : 1;
+    q.height = q.height > 0 ? q.height : 1;
+    printf("Rendering at %dx%d\n", q.width, q.height);
+    if (num_folded)
+        printf("Folded %d transforms in to constant matrices\n", num_folded);
+
+    num_jobs = jobs < num_frames ? jobs : num_frames;
+    q.verbose = num_jobs == 1;
+    q.next_frame = 0;
+    if (num_frames > 1 && !video_out) {
+        sprintf(gif_name, "%s.gif", name);
+        gif = new_gif(gif_name, q.width, q.height, 3, gif_palette, gif_dither);
+        if (!gif) {
+            printf("error: could not open %s\n", gif_name);
+            exit(1);
+        }
+    }
+    q.out = new_output_queue(q.width, q.height, writers, gif, video_out);
+    if (num_jobs > 1)
+        printf("Drawing %d frames on %d threads\n", num_frames, num_jobs);
+
+    q.under = q.over = NULL;
+    q.under_zb = q.over_zb = NULL;
+    if (num_under)
+        draw_layer(&q, LAYER_UNDER, &q.under, &q.under_zb);
+    if (num_over)
+        draw_layer(&q, LAYER_OVER, &q.over, &q.over_zb);
+    if (num_under + num_over)
+        printf("Drew %d static objects once: %d under and %d over each frame\n",
+               num_under + num_over, num_under, num_over);
+
+    threads = (pthread_t *)malloc(num_jobs * sizeof(pthread_t));
+    for (k = 1; k < num_jobs; k++)
+        if (pthread_create(threads + k, NULL, draw_frames, &q)) {
+            printf("error: could not start frame thread %d\n", k);
+            exit(1);
+        }
+    draw_frames(&q);
+    for (k = 1; k < num_jobs; k++)
+        pthread_join(threads[k], NULL);
+    free(threads);
+    free_output_queue(q.out);
+    if (q.under) {
+        free_screen(q.under);
+        free_zbuffer(q.under_zb);
+    }
+    if (q.over) {
+        free_screen(q.over);
+        free_zbuffer(q.over_zb);
     }
 
-    free(knobs);
+    if (gif) {
+        if (close_gif(gif))
+            printf("error: could not write %s\n", gif_name);
+        else
+            printf("Made animation: %s\n", gif_name);
+    }
+    if (video_out && close_stream(video_out))
+        printf("error: could not write stream %s\n", stream_dest);
+
+    mesh_cache_stats(&mesh_hits, &mesh_misses, &mesh_bytes);
+    if (mesh_hits + mesh_misses)
+        printf("Mesh cache: %ld hits, %ld misses, %ld bytes resident\n",
+               mesh_hits, mesh_misses, mesh_bytes);
+    free_mesh_cache();
+    free_shape_cache();
+
+    free(q.knobs);
+    free(folded);
 }
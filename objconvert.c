@@ -0,0 +1,50 @@
+/*====================== objconvert.c ========================
+Converts OBJ meshes to the binary mesh format in mesh.h, which
+the mesh command maps straight in to memory instead of parsing.
+
+  ./objconvert cow.obj            writes cow.mdlm
+  ./objconvert cow.obj other.mdlm
+
+The mesh command takes either kind of file under any name.
+==================================================*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mesh.h"
+
+int main(int argc, char **argv) {
+
+    struct mesh mesh;
+    char out[1024];
+    char *dot;
+
+    if (argc != 2 && argc != 3) {
+        printf("usage: %s <in.obj> [out.mdlm]\n", argv[0]);
+        return 1;
+    }
+
+    if (argc == 3)
+        snprintf(out, sizeof(out), "%s", argv[2]);
+    else {
+        snprintf(out, sizeof(out) - 5, "%s", argv[1]);
+        dot = strrchr(out, '.');
+        if (dot && !strchr(dot, '/'))
+            *dot = '\0';
+        strcat(out, ".mdlm");
+    }
+
+    mesh_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (read_mesh(argv[1], &mesh))
+        return 1;
+    if (write_mesh(&mesh, out)) {
+        printf("error: could not write %s\n", out);
+        return 1;
+    }
+    printf("%s: %d vertices, %d triangles -> %s\n", argv[1],
+           mesh.num_vertices, mesh.num_triangles, out);
+    release_mesh(&mesh);
+    return 0;
+}
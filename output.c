@@ -0,0 +1,303 @@
+/*====================== output.c ========================
+Asynchronous image output.
+
+Writing an image means encoding every pixel and pushing it
+through a pipe to convert, which takes about as long as drawing
+a simple frame. Instead of the drawing thread doing that, it
+hands the finished image to a queue drained by writer threads
+and goes straight on to the next frame.
+
+Animation frames also go to the GIF and the video stream, if
+there are any. With more than one drawing or writer thread they
+can be done out of order, so ones that come early are copied
+aside until the frames before them have gone out.
+
+output_frame swaps the pixels of the finished screen with a
+free buffer of the queue rather than copying them, so with one
+writer a frame is drawn while the last one is being written and
+the one before waits its turn. When every buffer is taken,
+output_frame blocks until a writer frees one.
+==================================================*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "ml6.h"
+#include "display.h"
+#include "output.h"
+
+/*======== static void send_frame() ==========
+Inputs:   struct output_queue *q
+          screen s
+Returns:
+
+Adds s to the animation as its next frame
+====================*/
+static void send_frame( struct output_queue *q, screen s ) {
+
+  if ( q->gif )
+    add_gif_frame(q->gif, s);
+  if ( q->stream )
+    write_stream_frame(q->stream, s);
+  q->next_frame++;
+}
+
+/*======== static void order_frame() ==========
+Inputs:   struct output_queue *q
+          screen s
+          int frame
+Returns:
+
+Sends s as frame number frame (counting from 0) once every
+frame before it has been sent, along with any early frames
+that can then follow it. A copy of s is kept if it has to
+wait. Frames are encoded by whichever thread brings in the
+one the animation is waiting for, holding order_lock.
+====================*/
+static void order_frame( struct output_queue *q, screen s, int frame ) {
+
+  struct output_early *e;
+  int k;
+
+  pthread_mutex_lock(&q->order_lock);
+  if ( frame != q->next_frame ) {
+    if ( q->num_early == q->size_early ) {
+      q->size_early = q->size_early ? q->size_early * 2 : 8;
+      q->early = (struct output_early *)realloc(q->early, q->size_early *
+                                                sizeof(struct output_early));
+    }
+    e = q->early + q->num_early++;
+    e->frame = frame;
+    e->s = new_screen(s->width, s->height);
+    memcpy(e->s->pixels, s->pixels, s->width * s->height * sizeof(pixel));
+    pthread_mutex_unlock(&q->order_lock);
+    return;
+  }
+
+  send_frame(q, s);
+  for (k = 0; k < q->num_early; k++)
+    if ( q->early[k].frame == q->next_frame ) {
+      send_frame(q, q->early[k].s);
+      free_screen(q->early[k].s);
+      q->early[k] = q->early[--q->num_early];
+      k = -1;
+    }
+  pthread_mutex_unlock(&q->order_lock);
+}
+
+/*======== static void *write_images() ==========
+Inputs:   void *arg
+Returns: NULL
+
+Writer thread body. Saves queued images in the order they
+were queued, and adds frames to the animation, until the
+queue is stopped and empty.
+====================*/
+static void *write_images( void *arg ) {
+
+  struct output_queue *q = (struct output_queue *)arg;
+  struct output_job job;
+
+  pthread_mutex_lock(&q->lock);
+  for (;;) {
+    while ( !q->count && !q->stop )
+      pthread_cond_wait(&q->changed, &q->lock);
+    if ( !q->count )
+      break;
+    job = q->jobs[q->head];
+    q->head = (q->head + 1) % q->buffers;
+    q->count--;
+    q->busy++;
+    pthread_mutex_unlock(&q->lock);
+
+    if ( job.file )
+      save_extension(job.s, job.file);
+    if ( job.frame >= 0 )
+      order_frame(q, job.s, job.frame);
+    free(job.file);
+
+    pthread_mutex_lock(&q->lock);
+    q->free_screens[q->num_free++] = job.s;
+    q->busy--;
+    pthread_cond_broadcast(&q->changed);
+  }
+  pthread_mutex_unlock(&q->lock);
+  return NULL;
+}
+
+/*======== struct output_queue *new_output_queue() ==========
+Inputs:   int width
+          int height
+          int writers
+          struct gif_writer *gif
+          struct video_stream *stream
+Returns: A queue for width x height images, drained by
+         writers threads
+
+Frames queued with output_frame are added to gif and
+written to stream, unless they are NULL. Each writer gets two buffers: one being written and one
+waiting.
+====================*/
+struct output_queue *new_output_queue( int width, int height, int writers,
+                                       struct gif_writer *gif,
+                                       struct video_stream *stream ) {
+
+  struct output_queue *q;
+  int k;
+
+  writers = writers > 0 ? writers : 1;
+  q = (struct output_queue *)calloc(1, sizeof(struct output_queue));
+  pthread_mutex_init(&q->lock, NULL);
+  pthread_mutex_init(&q->order_lock, NULL);
+  pthread_cond_init(&q->changed, NULL);
+  q->buffers = 2 * writers;
+  q->free_screens = (screen *)malloc(q->buffers * sizeof(screen));
+  q->jobs = (struct output_job *)malloc(q->buffers * sizeof(struct output_job));
+  for (k = 0; k < q->buffers; k++)
+    q->free_screens[k] = new_screen(width, height);
+  q->num_free = q->buffers;
+  q->gif = gif;
+  q->stream = stream;
+
+  q->writers = (pthread_t *)malloc(writers * sizeof(pthread_t));
+  for (k = 0; k < writers; k++) {
+    if ( pthread_create(q->writers + k, NULL, write_images, q) ) {
+      printf("error: could not start writer thread %d\n", k);
+      exit(1);
+    }
+    q->num_writers++;
+  }
+  return q;
+}
+
+/*======== void free_output_queue() ==========
+Inputs:   struct output_queue *q
+Returns:
+
+Writes everything still queued, then stops the writers
+and frees q. Frames still waiting for one that never came
+are sent in order anyway.
+====================*/
+void free_output_queue( struct output_queue *q ) {
+
+  int k, first;
+
+  pthread_mutex_lock(&q->lock);
+  q->stop = 1;
+  pthread_cond_broadcast(&q->changed);
+  pthread_mutex_unlock(&q->lock);
+  for (k = 0; k < q->num_writers; k++)
+    pthread_join(q->writers[k], NULL);
+
+  while ( q->num_early ) {
+    first = 0;
+    for (k = 1; k < q->num_early; k++)
+      if ( q->early[k].frame < q->early[first].frame )
+        first = k;
+    send_frame(q, q->early[first].s);
+    free_screen(q->early[first].s);
+    q->early[first] = q->early[--q->num_early];
+  }
+
+  for (k = 0; k < q->num_free; k++)
+    free_screen(q->free_screens[k]);
+  pthread_mutex_destroy(&q->lock);
+  pthread_mutex_destroy(&q->order_lock);
+  free(q->early);
+  pthread_cond_destroy(&q->changed);
+  free(q->free_screens);
+  free(q->jobs);
+  free(q->writers);
+  free(q);
+}
+
+/*======== static void queue_image() ==========
+Inputs:   struct output_queue *q
+          screen s
+          char *file
+          int frame
+          int swap
+Returns:
+
+Waits for a free buffer, fills it with the pixels of s, by
+swapping them if swap is set and copying them otherwise, and
+queues it to be saved as file and added as frame
+====================*/
+static void queue_image( struct output_queue *q, screen s, char *file,
+                         int frame, int swap ) {
+
+  screen f;
+  pixel *p;
+
+  pthread_mutex_lock(&q->lock);
+  while ( !q->num_free )
+    pthread_cond_wait(&q->changed, &q->lock);
+  f = q->free_screens[--q->num_free];
+  pthread_mutex_unlock(&q->lock);
+
+  if ( f->width != s->width || f->height != s->height ) {
+    printf("error: %dx%d image queued for %dx%d output\n",
+           s->width, s->height, f->width, f->height);
+    exit(1);
+  }
+  if ( swap ) {
+    p = f->pixels;
+    f->pixels = s->pixels;
+    s->pixels = p;
+  }
+  else
+    memcpy(f->pixels, s->pixels, s->width * s->height * sizeof(pixel));
+
+  pthread_mutex_lock(&q->lock);
+  q->jobs[(q->head + q->count) % q->buffers].s = f;
+  q->jobs[(q->head + q->count) % q->buffers].file = file ? strdup(file) : NULL;
+  q->jobs[(q->head + q->count) % q->buffers].frame = frame;
+  q->count++;
+  pthread_cond_broadcast(&q->changed);
+  pthread_mutex_unlock(&q->lock);
+}
+
+/*======== void output_frame() ==========
+Inputs:   struct output_queue *q
+          screen s
+          char *file
+          int frame
+Returns:
+
+Queues the image in s to be saved as file, if file is not
+NULL, and added to the animation as frame. s is left with
+the pixels of a previous image and must be cleared before
+it is drawn on again.
+====================*/
+void output_frame( struct output_queue *q, screen s, char *file, int frame ) {
+  queue_image(q, s, file, frame, 1);
+}
+
+/*======== void output_copy() ==========
+Inputs:   struct output_queue *q
+          screen s
+          char *file
+Returns:
+
+Queues a copy of the image in s to be saved as file,
+leaving s as it is
+====================*/
+void output_copy( struct output_queue *q, screen s, char *file ) {
+  queue_image(q, s, file, -1, 0);
+}
+
+/*======== void flush_output() ==========
+Inputs:   struct output_queue *q
+Returns:
+
+Waits until every image queued so far has been written
+====================*/
+void flush_output( struct output_queue *q ) {
+
+  pthread_mutex_lock(&q->lock);
+  while ( q->count || q->busy )
+    pthread_cond_wait(&q->changed, &q->lock);
+  pthread_mutex_unlock(&q->lock);
+}
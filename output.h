@@ -0,0 +1,65 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <pthread.h>
+
+#include "ml6.h"
+#include "gif.h"
+#include "stream.h"
+
+/*
+  A finished image waiting to be written to file (unless file
+  is NULL) and, when frame is not -1, added to the animation.
+  s is one of the queue's own screens.
+*/
+struct output_job {
+  screen s;
+  char *file;
+  int frame;
+};
+
+//a frame that was written before the one the animation is
+//waiting for, kept until its turn
+struct output_early {
+  int frame;
+  screen s;
+};
+
+/*
+  Finished images are handed to writer threads through a
+  bounded queue. The queue owns buffers screens; every job
+  holds one of them, so once they are all in use drawing
+  threads wait for a writer to catch up.
+
+  Animation frames then go to gif and stream in frame order,
+  which order_lock keeps; next_frame is the one they need.
+*/
+struct output_queue {
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+  screen *free_screens;
+  int num_free;
+  struct output_job *jobs;
+  int head, count;
+  int buffers;
+  int busy;
+  int stop;
+  pthread_t *writers;
+  int num_writers;
+  struct gif_writer *gif;
+  struct video_stream *stream;
+  pthread_mutex_t order_lock;
+  int next_frame;
+  struct output_early *early;
+  int num_early, size_early;
+};
+
+struct output_queue *new_output_queue( int width, int height, int writers,
+                                       struct gif_writer *gif,
+                                       struct video_stream *stream );
+void free_output_queue( struct output_queue *q );
+void output_frame( struct output_queue *q, screen s, char *file, int frame );
+void output_copy( struct output_queue *q, screen s, char *file );
+void flush_output( struct output_queue *q );
+
+#endif
@@ -119,6 +119,9 @@ struct command
     struct { 
       double value;
     } focal;
+    struct {
+      double width, height;
+    } resolution;
   } op;
 };
 
@@ -130,6 +133,23 @@ extern struct command op[MAX_COMMANDS];
 int num_frames;
 char name[128];
 
+//Render settings, set by parse_options and the resolution command.
+//xres and yres stay 0 until something sets them.
+extern int xres, yres;
+extern double preview_scale;
+extern int raster_threads;
+extern int jobs;
+extern int writers;
+extern char *frame_format;
+extern int gif_palette;
+extern int gif_dither;
+extern char *stream_dest;
+extern int stream_format;
+extern struct video_stream *video_out;
+extern int use_hiz;
+extern int use_layers;
+extern double lod_tolerance;
+
 struct vary_node {
   
   char name[128];
@@ -146,6 +166,7 @@ void set_constants(struct constants *c, double *a, double *d, double *s);
 void reset_constants(double *a, double *d, double *s, double *a_default, double *d_default, double *s_default);
 
 void print_pcode();
+int parse_options(int argc, char **argv);
 void my_main();
 #endif
 
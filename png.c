@@ -0,0 +1,364 @@
+/*====================== png.c ========================
+PNG writer.
+
+Rows are packed to 8-bit RGB and each one is run through the
+PNG filter (none, sub, up, average or paeth) that leaves the
+smallest sum of absolute byte values, the usual heuristic for
+picking filters.
+
+The filtered rows are then split in to bands of about
+PNG_CHUNK_BYTES that are deflated independently on png_threads
+threads, the way pigz does it: each band is primed with the last
+32KB of the band before it as a dictionary and ends on a byte
+boundary with a sync flush, so the compressed bands simply run
+together into one zlib stream, whose adler32 is put together
+from the ones of the bands.
+==================================================*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <zlib.h>
+
+#include "ml6.h"
+#include "png.h"
+
+int png_threads = 1;
+
+/*
+  A band of rows, with its filtered bytes (in the image wide
+  buffer) and what they compressed to
+*/
+struct png_band {
+  int row0, row1;
+  unsigned char *out;
+  unsigned long out_len;
+  unsigned long adler;
+  int error;
+};
+
+struct png_job {
+  screen s;
+  unsigned char *filtered;
+  int stride;
+  struct png_band *bands;
+  int num_bands;
+  int next;
+  int phase;
+};
+
+/*======== static void pack_row() ==========
+Inputs:   screen s
+          int y
+          unsigned char *out
+Returns:
+
+Packs row y of s in to out as 3 bytes per pixel
+====================*/
+static void pack_row( screen s, int y, unsigned char *out ) {
+
+  pixel *p = s->pixels + y * s->width;
+  int x;
+
+  for (x = 0; x < s->width; x++) {
+    out[3*x] = p[x].red;
+    out[3*x+1] = p[x].green;
+    out[3*x+2] = p[x].blue;
+  }
+}
+
+/*======== static unsigned char paeth() ==========
+Inputs:   int a
+          int b
+          int c
+Returns: Whichever of a (left), b (up) and c (up left) is
+         closest to a + b - c
+====================*/
+static unsigned char paeth( int a, int b, int c ) {
+
+  int p = a + b - c;
+  int pa = abs(p - a);
+  int pb = abs(p - b);
+  int pc = abs(p - c);
+
+  if ( pa <= pb && pa <= pc )
+    return a;
+  if ( pb <= pc )
+    return b;
+  return c;
+}
+
+/*======== static void filter_row() ==========
+Inputs:   unsigned char *row
+          unsigned char *prev
+          int len
+          unsigned char *out
+          unsigned char *scratch
+Returns:
+
+Writes the filter type byte and the len filtered bytes of row
+to out, using whichever filter gives the smallest sum of
+absolute values. prev is the row above, or all zeroes for the
+first row. scratch must hold len bytes.
+====================*/
+static void filter_row( unsigned char *row, unsigned char *prev, int len,
+                        unsigned char *out, unsigned char *scratch ) {
+
+  long sum, best_sum = -1;
+  int type, k, a, c;
+  unsigned char v;
+
+  for (type = 0; type < 5; type++) {
+    sum = 0;
+    for (k = 0; k < len; k++) {
+      a = k >= 3 ? row[k-3] : 0;
+      c = k >= 3 ? prev[k-3] : 0;
+      switch ( type ) {
+      case 0: v = row[k]; break;
+      case 1: v = row[k] - a; break;
+      case 2: v = row[k] - prev[k]; break;
+      case 3: v = row[k] - ((a + prev[k]) >> 1); break;
+      default: v = row[k] - paeth(a, prev[k], c);
+      }
+      scratch[k] = v;
+      sum += v < 128 ? v : 256 - v;
+    }
+    if ( best_sum < 0 || sum < best_sum ) {
+      best_sum = sum;
+      out[0] = type;
+      memcpy(out + 1, scratch, len);
+    }
+  }
+}
+
+/*======== static void filter_band() ==========
+Inputs:   struct png_job *job
+          struct png_band *b
+Returns:
+
+Filters the rows of band b in to job->filtered
+====================*/
+static void filter_band( struct png_job *job, struct png_band *b ) {
+
+  int len = job->stride - 1;
+  unsigned char *rows = (unsigned char *)calloc(3 * len, 1);
+  unsigned char *row = rows, *prev = rows + len, *tmp;
+  int y;
+
+  if ( b->row0 > 0 )
+    pack_row(job->s, b->row0 - 1, prev);
+  for (y = b->row0; y < b->row1; y++) {
+    pack_row(job->s, y, row);
+    filter_row(row, prev, len, job->filtered + y * job->stride, rows + 2 * len);
+    tmp = prev;
+    prev = row;
+    row = tmp;
+  }
+  free(rows);
+}
+
+/*======== static void deflate_band() ==========
+Inputs:   struct png_job *job
+          int k
+Returns:
+
+Compresses the filtered rows of band k on their own, with the
+32KB before them as the dictionary
+====================*/
+static void deflate_band( struct png_job *job, int k ) {
+
+  struct png_band *b = job->bands + k;
+  unsigned char *in = job->filtered + b->row0 * job->stride;
+  unsigned long in_len = (unsigned long)(b->row1 - b->row0) * job->stride;
+  unsigned long dict_len;
+  z_stream z;
+
+  memset(&z, 0, sizeof(z));
+  b->adler = adler32(adler32(0, NULL, 0), in, in_len);
+  if ( deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8,
+                    Z_FILTERED) != Z_OK ) {
+    b->error = 1;
+    return;
+  }
+  dict_len = b->row0 * job->stride;
+  dict_len = dict_len < 32768 ? dict_len : 32768;
+  if ( dict_len )
+    deflateSetDictionary(&z, in - dict_len, dict_len);
+
+  b->out = (unsigned char *)malloc(deflateBound(&z, in_len) + 16);
+  z.next_in = in;
+  z.avail_in = in_len;
+  z.next_out = b->out;
+  z.avail_out = deflateBound(&z, in_len) + 16;
+  if ( deflate(&z, k == job->num_bands - 1 ? Z_FINISH : Z_SYNC_FLUSH) == Z_STREAM_ERROR ||
+       z.avail_in )
+    b->error = 1;
+  b->out_len = z.total_out;
+  deflateEnd(&z);
+}
+
+/*======== static void *png_worker() ==========
+Inputs:   void *arg
+Returns: NULL
+
+Takes bands of job until there are none left, filtering them
+in phase 0 and compressing them in phase 1
+====================*/
+static void *png_worker( void *arg ) {
+
+  struct png_job *job = (struct png_job *)arg;
+  int k;
+
+  while ( (k = __sync_fetch_and_add(&job->next, 1)) < job->num_bands ) {
+    if ( job->phase == 0 )
+      filter_band(job, job->bands + k);
+    else
+      deflate_band(job, k);
+  }
+  return NULL;
+}
+
+/*======== static void run_phase() ==========
+Inputs:   struct png_job *job
+          int phase
+Returns:
+
+Runs one phase over every band, on up to png_threads threads
+(this one included)
+====================*/
+static void run_phase( struct png_job *job, int phase ) {
+
+  pthread_t threads[64];
+  int n, k, started = 0;
+
+  job->phase = phase;
+  job->next = 0;
+  n = png_threads < job->num_bands ? png_threads : job->num_bands;
+  n = n < 64 ? n : 64;
+  for (k = 1; k < n; k++)
+    if ( !pthread_create(threads + started, NULL, png_worker, job) )
+      started++;
+  png_worker(job);
+  for (k = 0; k < started; k++)
+    pthread_join(threads[k], NULL);
+}
+
+/*======== static void put_u32() ==========
+Inputs:   unsigned char *p
+          unsigned long v
+Returns:
+
+Stores v at p as 4 big endian bytes
+====================*/
+static void put_u32( unsigned char *p, unsigned long v ) {
+  p[0] = v >> 24;
+  p[1] = v >> 16;
+  p[2] = v >> 8;
+  p[3] = v;
+}
+
+/*======== static void write_chunk() ==========
+Inputs:   FILE *f
+          char *type
+          unsigned char *data
+          unsigned long len
+Returns:
+
+Writes a PNG chunk: length, type, data and CRC
+====================*/
+static void write_chunk( FILE *f, char *type, unsigned char *data,
+                         unsigned long len ) {
+
+  unsigned char word[4];
+  unsigned long crc;
+
+  put_u32(word, len);
+  fwrite(word, 1, 4, f);
+  fwrite(type, 1, 4, f);
+  crc = crc32(crc32(0, NULL, 0), (unsigned char *)type, 4);
+  if ( len ) {
+    fwrite(data, 1, len, f);
+    crc = crc32(crc, data, len);
+  }
+  put_u32(word, crc);
+  fwrite(word, 1, 4, f);
+}
+
+/*======== int save_png() ==========
+Inputs:   screen s
+          char *file
+Returns: 0 on success, -1 if file could not be written
+
+Saves s as an 8-bit RGB PNG
+====================*/
+int save_png( screen s, char *file ) {
+
+  static unsigned char signature[8] = {137, 'P', 'N', 'G', '\r', '\n', 26, '\n'};
+  struct png_job job;
+  unsigned char ihdr[13], *idat, *p;
+  unsigned long idat_len, adler;
+  int rows_per_band, k, error = 0;
+  FILE *f;
+
+  job.s = s;
+  job.stride = 1 + 3 * s->width;
+  job.filtered = (unsigned char *)malloc((size_t)job.stride * s->height);
+  rows_per_band = PNG_CHUNK_BYTES / job.stride;
+  rows_per_band = rows_per_band > 0 ? rows_per_band : 1;
+  job.num_bands = (s->height + rows_per_band - 1) / rows_per_band;
+  job.bands = (struct png_band *)calloc(job.num_bands, sizeof(struct png_band));
+  for (k = 0; k < job.num_bands; k++) {
+    job.bands[k].row0 = k * rows_per_band;
+    job.bands[k].row1 = (k + 1) * rows_per_band < s->height ?
+      (k + 1) * rows_per_band : s->height;
+  }
+
+  run_phase(&job, 0);
+  run_phase(&job, 1);
+
+  //zlib header, the bands, then the adler32 of everything
+  idat_len = 2 + 4;
+  adler = adler32(0, NULL, 0);
+  for (k = 0; k < job.num_bands; k++) {
+    error |= job.bands[k].error;
+    idat_len += job.bands[k].out_len;
+    adler = adler32_combine(adler, job.bands[k].adler,
+                            (long)(job.bands[k].row1 - job.bands[k].row0) * job.stride);
+  }
+  idat = p = (unsigned char *)malloc(idat_len);
+  *p++ = 0x78;
+  *p++ = 0x9c;
+  for (k = 0; k < job.num_bands; k++) {
+    memcpy(p, job.bands[k].out, job.bands[k].out_len);
+    p += job.bands[k].out_len;
+    free(job.bands[k].out);
+  }
+  put_u32(p, adler);
+  free(job.bands);
+  free(job.filtered);
+
+  f = error ? NULL : fopen(file, "wb");
+  if ( !f ) {
+    printf("error: could not write %s\n", file);
+    free(idat);
+    return -1;
+  }
+  put_u32(ihdr, s->width);
+  put_u32(ihdr + 4, s->height);
+  ihdr[8] = 8;   //bits per channel
+  ihdr[9] = 2;   //RGB
+  ihdr[10] = 0;  //deflate
+  ihdr[11] = 0;  //adaptive filtering
+  ihdr[12] = 0;  //not interlaced
+  fwrite(signature, 1, 8, f);
+  write_chunk(f, "IHDR", ihdr, 13);
+  write_chunk(f, "IDAT", idat, idat_len);
+  write_chunk(f, "IEND", NULL, 0);
+  free(idat);
+  if ( fclose(f) ) {
+    printf("error: could not write %s\n", file);
+    return -1;
+  }
+  return 0;
+}
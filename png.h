@@ -0,0 +1,15 @@
+#ifndef PNG_H
+#define PNG_H
+
+#include "ml6.h"
+
+//rows of filtered image data compressed together, about the
+//128KB blocks pigz uses
+#define PNG_CHUNK_BYTES 131072
+
+//threads save_png compresses on, set from --threads
+extern int png_threads;
+
+int save_png( screen s, char *file );
+
+#endif
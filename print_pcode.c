@@ -192,6 +192,11 @@ void print_pcode()
 	case DISPLAY:
 	  printf("Display");
 	  break;
+	case RESOLUTION:
+	  printf("Resolution: %4.0f %4.0f",
+		 op[i].op.resolution.width,
+		 op[i].op.resolution.height);
+	  break;
     }
       printf("\n");
     }
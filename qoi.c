@@ -0,0 +1,125 @@
+/*====================== qoi.c ========================
+QOI writer (the "Quite OK Image" format, qoiformat.org).
+
+A fast lossless format for frames that are read back by other
+tools: every pixel becomes a run of the previous pixel, an
+index in to the 64 most recently hashed colors, a small
+difference from the previous pixel, or a plain RGB triple.
+It compresses rendered frames, with their large flat areas,
+about as well as PNG at a fraction of the cost.
+==================================================*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "ml6.h"
+#include "qoi.h"
+
+/*======== static unsigned char *put_u32() ==========
+Inputs:   unsigned char *p
+          unsigned long v
+Returns: p advanced past v
+
+Stores v at p as 4 big endian bytes
+====================*/
+static unsigned char *put_u32( unsigned char *p, unsigned long v ) {
+  p[0] = v >> 24;
+  p[1] = v >> 16;
+  p[2] = v >> 8;
+  p[3] = v;
+  return p + 4;
+}
+
+/*======== int save_qoi() ==========
+Inputs:   screen s
+          char *file
+Returns: 0 on success, -1 if file could not be written
+
+Saves s as a 3 channel QOI image. The whole file is
+encoded in memory and written with one fwrite.
+====================*/
+int save_qoi( screen s, char *file ) {
+
+  //colors are kept as r | g << 8 | b << 16 | 255 << 24, so the
+  //zeroed index starts out matching nothing, as the format wants
+  unsigned int index[64] = {0};
+  unsigned int px, prev = 0xff000000u;
+  unsigned char *out, *p;
+  pixel *q;
+  int n, k, run = 0, h;
+  int vr, vg, vb, vg_r, vg_b;
+  FILE *f;
+  size_t len;
+
+  n = s->width * s->height;
+  out = p = (unsigned char *)malloc(14 + (size_t)n * 4 + 8);
+  *p++ = 'q';
+  *p++ = 'o';
+  *p++ = 'i';
+  *p++ = 'f';
+  p = put_u32(p, s->width);
+  p = put_u32(p, s->height);
+  *p++ = 3;  //RGB
+  *p++ = 0;  //sRGB
+
+  for (k = 0; k < n; k++) {
+    q = s->pixels + k;
+    px = q->red | q->green << 8 | q->blue << 16 | 0xff000000u;
+
+    if ( px == prev ) {
+      run++;
+      if ( run == 62 || k == n - 1 ) {
+        *p++ = QOI_OP_RUN | (run - 1);
+        run = 0;
+      }
+      continue;
+    }
+    if ( run ) {
+      *p++ = QOI_OP_RUN | (run - 1);
+      run = 0;
+    }
+
+    h = (q->red * 3 + q->green * 5 + q->blue * 7 + 255 * 11) % 64;
+    if ( index[h] == px )
+      *p++ = QOI_OP_INDEX | h;
+    else {
+      index[h] = px;
+      vr = (signed char)(q->red - (prev & 0xff));
+      vg = (signed char)(q->green - (prev >> 8 & 0xff));
+      vb = (signed char)(q->blue - (prev >> 16 & 0xff));
+      vg_r = vr - vg;
+      vg_b = vb - vg;
+      if ( vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2 )
+        *p++ = QOI_OP_DIFF | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2);
+      else if ( vg_r > -9 && vg_r < 8 && vg > -33 && vg < 32 &&
+                vg_b > -9 && vg_b < 8 ) {
+        *p++ = QOI_OP_LUMA | (vg + 32);
+        *p++ = (vg_r + 8) << 4 | (vg_b + 8);
+      }
+      else {
+        *p++ = QOI_OP_RGB;
+        *p++ = q->red;
+        *p++ = q->green;
+        *p++ = q->blue;
+      }
+    }
+    prev = px;
+  }
+  //end marker
+  for (k = 0; k < 7; k++)
+    *p++ = 0;
+  *p++ = 1;
+
+  len = p - out;
+  f = fopen(file, "wb");
+  if ( f ) {
+    k = fwrite(out, 1, len, f) == len;
+    k = !fclose(f) && k;
+  }
+  free(out);
+  if ( !f || !k ) {
+    printf("error: could not write %s\n", file);
+    return -1;
+  }
+  return 0;
+}
@@ -0,0 +1,15 @@
+#ifndef QOI_H
+#define QOI_H
+
+#include "ml6.h"
+
+//QOI chunk tags
+#define QOI_OP_INDEX 0x00
+#define QOI_OP_DIFF 0x40
+#define QOI_OP_LUMA 0x80
+#define QOI_OP_RUN 0xc0
+#define QOI_OP_RGB 0xfe
+
+int save_qoi( screen s, char *file );
+
+#endif
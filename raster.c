@@ -0,0 +1,282 @@
+/*====================== raster.c ========================
+Sort-middle tiled rasterizer.
+
+While binning is enabled for a screen, draw_polygons and
+draw_lines hand their lit, screen space primitives to
+bin_triangle and bin_line. Each primitive is stored once and
+its index is added to every TILE_SIZE x TILE_SIZE tile its
+bounding box overlaps.
+
+flush_bins then draws the tiles on a pool of threads. A tile
+is drawn with the screen clipped to its own rectangle and
+replays its primitives in the order they were binned, so every
+pixel sees exactly the same sequence of writes as it would
+when drawing right away, and no two threads share a pixel.
+==================================================*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "ml6.h"
+#include "display.h"
+#include "draw.h"
+#include "matrix.h"
+#include "raster.h"
+
+struct raster_job {
+  screen s;
+  zbuffer zb;
+  int *tiles;
+  int num_tiles;
+  int next;
+};
+
+/*======== void enable_binning() ==========
+Inputs:   screen s
+          int threads
+Returns:
+
+Sets up the tiles for s. From now on primitives drawn to s
+are queued until flush_bins is called, which draws them
+using up to threads threads.
+====================*/
+void enable_binning( screen s, int threads ) {
+
+  struct raster_bins *b;
+  struct raster_tile *t;
+  int tx, ty;
+
+  disable_binning(s);
+  b = (struct raster_bins *)malloc(sizeof(struct raster_bins));
+  b->threads = threads > 0 ? threads : 1;
+  b->tiles_x = (s->width + TILE_SIZE - 1) / TILE_SIZE;
+  b->tiles_y = (s->height + TILE_SIZE - 1) / TILE_SIZE;
+  b->tiles = (struct raster_tile *)malloc(b->tiles_x * b->tiles_y *
+                                          sizeof(struct raster_tile));
+  for (ty = 0; ty < b->tiles_y; ty++)
+    for (tx = 0; tx < b->tiles_x; tx++) {
+      t = b->tiles + ty * b->tiles_x + tx;
+      t->x0 = tx * TILE_SIZE;
+      t->y0 = ty * TILE_SIZE;
+      t->x1 = t->x0 + TILE_SIZE < s->width ? t->x0 + TILE_SIZE : s->width;
+      t->y1 = t->y0 + TILE_SIZE < s->height ? t->y0 + TILE_SIZE : s->height;
+      t->prims = NULL;
+      t->num_prims = 0;
+      t->size = 0;
+    }
+  b->points = new_matrix(4, 1000);
+  b->prims = NULL;
+  b->num_prims = 0;
+  b->size = 0;
+  s->bins = b;
+}
+
+/*======== void disable_binning() ==========
+Inputs:   screen s
+Returns:
+
+Frees the tiles of s and goes back to drawing right away.
+Anything still queued is thrown away.
+====================*/
+void disable_binning( screen s ) {
+
+  struct raster_bins *b = s->bins;
+  int t;
+
+  if ( !b )
+    return;
+  for (t = 0; t < b->tiles_x * b->tiles_y; t++)
+    free(b->tiles[t].prims);
+  free(b->tiles);
+  free_matrix(b->points);
+  free(b->prims);
+  free(b);
+  s->bins = NULL;
+}
+
+/*======== static void bin_prim() ==========
+Inputs:   screen s
+          struct matrix *points
+          int i
+          int n
+          int type
+          color c
+Returns:
+
+Copies the n points of the primitive starting at column i
+and adds it to every tile that it may touch. Primitives
+entirely off the screen are dropped.
+====================*/
+static void bin_prim( screen s, struct matrix *points, int i, int n,
+                      int type, color c ) {
+
+  struct raster_bins *b = s->bins;
+  struct raster_tile *t;
+  double xmin, xmax, ymin, ymax, rmin, rmax;
+  int tx0, tx1, ty0, ty1, tx, ty, k;
+
+  xmin = xmax = points->m[0][i];
+  ymin = ymax = points->m[1][i];
+  for (k = 1; k < n; k++) {
+    xmin = fmin(xmin, points->m[0][i+k]);
+    xmax = fmax(xmax, points->m[0][i+k]);
+    ymin = fmin(ymin, points->m[1][i+k]);
+    ymax = fmax(ymax, points->m[1][i+k]);
+  }
+
+  //pixel columns come from truncating x and rows are flipped y,
+  //pad by a pixel so rounding can never escape the box
+  xmin = floor(xmin) - 1;
+  xmax = ceil(xmax) + 1;
+  rmin = s->height - 1 - ceil(ymax) - 1;
+  rmax = s->height - 1 - floor(ymin) + 1;
+  if ( !(xmax >= 0 && xmin < s->width && rmax >= 0 && rmin < s->height) )
+    return;
+
+  tx0 = xmin < 0 ? 0 : (int)xmin / TILE_SIZE;
+  tx1 = xmax >= s->width ? b->tiles_x - 1 : (int)xmax / TILE_SIZE;
+  ty0 = rmin < 0 ? 0 : (int)rmin / TILE_SIZE;
+  ty1 = rmax >= s->height ? b->tiles_y - 1 : (int)rmax / TILE_SIZE;
+
+  if ( b->num_prims == b->size ) {
+    b->size = b->size ? b->size * 2 : 1024;
+    b->prims = (struct raster_prim *)realloc(b->prims, b->size *
+                                             sizeof(struct raster_prim));
+  }
+  b->prims[b->num_prims].type = type;
+  b->prims[b->num_prims].col = b->points->lastcol;
+  b->prims[b->num_prims].c = c;
+  for (k = 0; k < n; k++)
+    add_point(b->points, points->m[0][i+k], points->m[1][i+k],
+              points->m[2][i+k]);
+
+  for (ty = ty0; ty <= ty1; ty++)
+    for (tx = tx0; tx <= tx1; tx++) {
+      t = b->tiles + ty * b->tiles_x + tx;
+      if ( t->num_prims == t->size ) {
+        t->size = t->size ? t->size * 2 : 64;
+        t->prims = (int *)realloc(t->prims, t->size * sizeof(int));
+      }
+      t->prims[t->num_prims++] = b->num_prims;
+    }
+  b->num_prims++;
+}
+
+/*======== void bin_triangle() ==========
+Inputs:   screen s
+          struct matrix *polygons
+          int i
+          color c
+Returns:
+
+Queues triangle i of polygons to be drawn in color c
+====================*/
+void bin_triangle( screen s, struct matrix *polygons, int i, color c ) {
+  bin_prim(s, polygons, i, 3, RASTER_TRIANGLE, c);
+}
+
+/*======== void bin_line() ==========
+Inputs:   screen s
+          struct matrix *edges
+          int i
+          color c
+Returns:
+
+Queues the line from point i to point i+1 of edges to be
+drawn in color c
+====================*/
+void bin_line( screen s, struct matrix *edges, int i, color c ) {
+  bin_prim(s, edges, i, 2, RASTER_LINE, c);
+}
+
+/*======== static void draw_tile() ==========
+Inputs:   struct raster_bins *b
+          struct raster_tile *t
+          screen s
+          zbuffer zb
+Returns:
+
+Draws every primitive binned in t, clipped to t
+====================*/
+static void draw_tile( struct raster_bins *b, struct raster_tile *t,
+                       screen s, zbuffer zb ) {
+
+  struct screen_t clipped = *s;
+  struct matrix *p = b->points;
+  struct raster_prim *prim;
+  int k, col;
+
+  clipped.clip_x0 = t->x0;
+  clipped.clip_y0 = t->y0;
+  clipped.clip_x1 = t->x1;
+  clipped.clip_y1 = t->y1;
+  clipped.bins = NULL;
+
+  for (k = 0; k < t->num_prims; k++) {
+    prim = b->prims + t->prims[k];
+    col = prim->col;
+    if ( prim->type == RASTER_TRIANGLE )
+      draw_triangle(p, col, &clipped, zb, prim->c);
+    else
+      draw_edge( p->m[0][col], p->m[1][col], p->m[2][col],
+                 p->m[0][col+1], p->m[1][col+1], p->m[2][col+1],
+                 &clipped, zb, prim->c);
+  }
+  t->num_prims = 0;
+}
+
+static void *raster_worker( void *arg ) {
+
+  struct raster_job *job = (struct raster_job *)arg;
+  struct raster_bins *b = job->s->bins;
+  int t;
+
+  while ( (t = __sync_fetch_and_add(&job->next, 1)) < job->num_tiles )
+    draw_tile(b, b->tiles + job->tiles[t], job->s, job->zb);
+  return NULL;
+}
+
+/*======== void flush_bins() ==========
+Inputs:   screen s
+          zbuffer zb
+Returns:
+
+Draws everything queued for s into s and zb, then empties
+the queue. Does nothing when binning is not enabled.
+====================*/
+void flush_bins( screen s, zbuffer zb ) {
+
+  struct raster_bins *b = s->bins;
+  struct raster_job job;
+  pthread_t *workers;
+  int t, n, started;
+
+  if ( !b || !b->num_prims )
+    return;
+
+  job.s = s;
+  job.zb = zb;
+  job.next = 0;
+  job.num_tiles = 0;
+  job.tiles = (int *)malloc(b->tiles_x * b->tiles_y * sizeof(int));
+  for (t = 0; t < b->tiles_x * b->tiles_y; t++)
+    if ( b->tiles[t].num_prims )
+      job.tiles[job.num_tiles++] = t;
+
+  //the calling thread works too
+  n = b->threads < job.num_tiles ? b->threads : job.num_tiles;
+  workers = (pthread_t *)malloc(n * sizeof(pthread_t));
+  for (started = 0; started < n - 1; started++)
+    if ( pthread_create(workers + started, NULL, raster_worker, &job) )
+      break;
+  raster_worker(&job);
+  for (t = 0; t < started; t++)
+    pthread_join(workers[t], NULL);
+
+  free(workers);
+  free(job.tiles);
+  b->points->lastcol = 0;
+  b->num_prims = 0;
+}
@@ -0,0 +1,50 @@
+#ifndef RASTER_H
+#define RASTER_H
+
+#include "matrix.h"
+#include "ml6.h"
+
+//width and height in pixels of a rasterizer tile
+#define TILE_SIZE 64
+
+#define RASTER_TRIANGLE 0
+#define RASTER_LINE 1
+
+/*
+  A lit, screen space triangle or line waiting to be drawn.
+  Its vertices are the columns of bins->points starting at col.
+*/
+struct raster_prim {
+  int type;
+  int col;
+  color c;
+};
+
+/*
+  A TILE_SIZE x TILE_SIZE block of the screen, in pixel indicies,
+  with the primitives that overlap it in the order they were drawn.
+*/
+struct raster_tile {
+  int x0, y0, x1, y1;
+  int *prims;
+  int num_prims;
+  int size;
+};
+
+struct raster_bins {
+  int threads;
+  int tiles_x, tiles_y;
+  struct raster_tile *tiles;
+  struct matrix *points;
+  struct raster_prim *prims;
+  int num_prims;
+  int size;
+};
+
+void enable_binning( screen s, int threads );
+void disable_binning( screen s );
+void bin_triangle( screen s, struct matrix *polygons, int i, color c );
+void bin_line( screen s, struct matrix *edges, int i, color c );
+void flush_bins( screen s, zbuffer zb );
+
+#endif
@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "matrix.h"
 #include "stack.h"
 
@@ -13,18 +14,21 @@
 struct stack * new_stack() {
 
   struct stack *s;
-  struct matrix **m;
-  struct matrix *i;
+  int i, r;
   s = (struct stack *)malloc(sizeof(struct stack));
-  
-  m = (struct matrix **)malloc( STACK_SIZE * sizeof(struct matrix *));
-  i = new_matrix(4, 4);
-  ident( i );
+
+  for (i=0; i < STACK_SIZE; i++) {
+    for (r=0; r < 4; r++)
+      s->rows[i][r] = s->values[i][r];
+    s->data[i].m = s->rows[i];
+    s->data[i].rows = 4;
+    s->data[i].cols = 4;
+    s->data[i].lastcol = 4;
+  }
 
   s->size = STACK_SIZE;
   s->top = 0;
-  s->data = m;
-  s->data[ s->top ] = i;
+  ident( &s->data[ s->top ] );
 
   return s;
 }
@@ -37,7 +41,7 @@ struct stack * new_stack() {
   top of the stack
   ====================*/
 struct matrix * peek( struct stack *s ) {
-  return s->data[s->top];
+  return &s->data[s->top];
 }
 
 /*======== void push() ==========
@@ -50,32 +54,27 @@ struct matrix * peek( struct stack *s ) {
   ====================*/
 void push( struct stack *s ) {
 
-  struct matrix *m;
-  m = new_matrix(4, 4);
-  
   if ( s->top == s->size - 1 ) {
-    s->data = (struct matrix **)realloc( s->data, (s->size + STACK_SIZE)
-					 * sizeof(struct matrix *));
-    s->size = s->size + STACK_SIZE;
+    printf("error: coordinate systems nested more than %d deep\n", STACK_SIZE);
+    exit(1);
   }
 
-  copy_matrix( s->data[ s->top ], m);
-
+  memcpy( s->values[ s->top + 1 ], s->values[ s->top ], sizeof(s->values[0]) );
   s->top++;
-  s->data[ s->top ] = m;  
 }
 
 /*======== void pop() ==========
   Inputs:   struct stack * s 
   Returns: 
   
-  Remove and free the matrix at the top
+  Remove the matrix at the top. The one at the
+  bottom is never removed.
   Note you do not need to return anything.
   ====================*/
 void pop( struct stack * s) {
 
-  free_matrix(s->data[s->top]);
-  s->top--;
+  if ( s->top > 0 )
+    s->top--;
 }
 
 /*======== void free_stack() ==========
@@ -85,13 +84,6 @@ void pop( struct stack * s) {
   Deallocate all the memory used in the stack
   ====================*/
 void free_stack( struct stack *s) {
-
-  int i;
-  for (i=0; i <= s->top; i++) {
-
-    free_matrix(s->data[i]);
-  }
-  free(s->data);
   free(s);
 }
 
@@ -100,7 +92,7 @@ void print_stack(struct stack *s) {
   int i;
   for (i=s->top; i >= 0; i--) {
 
-    print_matrix(s->data[i]);
+    print_matrix(&s->data[i]);
     printf("\n");
   }
 
@@ -1,12 +1,23 @@
 #ifndef STACK_H
 #define STACK_H
 
-#define STACK_SIZE 2
+#include "matrix.h"
 
+//deepest nesting of push
+#define STACK_SIZE 64
+
+/*
+  Coordinate systems held in place: system k is the 4x4 matrix
+  in values[k], reached through data[k] (whose rows point in to
+  it) so it can be handed to anything that takes a matrix.
+  Nothing is allocated after new_stack.
+*/
 struct stack {
   int size;
   int top;
-  struct matrix **data;
+  struct matrix data[STACK_SIZE];
+  double *rows[STACK_SIZE][4];
+  double values[STACK_SIZE][4][4];
 };
 
 struct stack * new_stack();
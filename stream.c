@@ -0,0 +1,314 @@
+/*====================== stream.c ========================
+Raw video output.
+
+Instead of one image file per frame, every finished frame is
+written straight to a single stream, usually a pipe in to a
+video encoder, e.g.
+
+  ./mdl --stream - cow.mdl | ffmpeg -i - cow.mp4
+
+YUV4MPEG2 frames are converted to 8-bit BT.601 (studio range)
+Y'CbCr with 4:2:0 chroma, each chroma sample taken from the
+average of a 2x2 block. The conversion is integer only, so the
+SSE4.1 path gives exactly the same bytes as the scalar one.
+Raw RGB frames are just the pixels, packed, with no header.
+==================================================*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define STREAM_X86
+#endif
+
+#include "ml6.h"
+#include "display.h"
+#include "stream.h"
+
+typedef void (*yuv_rows_fn)( pixel *a, pixel *b, int width,
+                             unsigned char *ya, unsigned char *yb,
+                             unsigned char *u, unsigned char *v );
+
+static int luma( pixel *p ) {
+  return ((66 * p->red + 129 * p->green + 25 * p->blue + 128) >> 8) + 16;
+}
+
+/*======== static void yuv_rows_scalar() ==========
+Inputs:   pixel *a
+          pixel *b
+          int width
+          unsigned char *ya
+          unsigned char *yb
+          unsigned char *u
+          unsigned char *v
+Returns:
+
+Converts the pair of rows a and b to luma in ya and yb and
+one row of chroma in u and v. yb is NULL when b is a copy of
+the last row of an image with an odd height.
+====================*/
+static void yuv_rows_scalar( pixel *a, pixel *b, int width,
+                             unsigned char *ya, unsigned char *yb,
+                             unsigned char *u, unsigned char *v ) {
+
+  int x, x1, r, g, bl;
+
+  for (x = 0; x < width; x++) {
+    ya[x] = luma(a + x);
+    if ( yb )
+      yb[x] = luma(b + x);
+  }
+  for (x = 0; x < width; x += 2) {
+    x1 = x + 1 < width ? x + 1 : x;
+    r = a[x].red + a[x1].red + b[x].red + b[x1].red;
+    g = a[x].green + a[x1].green + b[x].green + b[x1].green;
+    bl = a[x].blue + a[x1].blue + b[x].blue + b[x1].blue;
+    u[x / 2] = ((-38 * r - 74 * g + 112 * bl + 512) >> 10) + 128;
+    v[x / 2] = ((112 * r - 94 * g - 18 * bl + 512) >> 10) + 128;
+  }
+}
+
+#ifdef STREAM_X86
+
+//shuffles picking channel c of pixels 0-7 out of 16 bytes at
+//the start of a row (LO) or 16 bytes further in (HI), one per
+//16 bit lane
+#define PX(i, c) ((i) * (int)sizeof(pixel) + (c))
+#define LO(i, c) (char)(PX(i, c) < 16 ? PX(i, c) : 0x80), (char)0x80
+#define HI(i, c) (char)(PX(i, c) >= 16 ? PX(i, c) - 16 : 0x80), (char)0x80
+#define LO_MASK(c) _mm_setr_epi8(LO(0, c), LO(1, c), LO(2, c), LO(3, c), \
+                                 LO(4, c), LO(5, c), LO(6, c), LO(7, c))
+#define HI_MASK(c) _mm_setr_epi8(HI(0, c), HI(1, c), HI(2, c), HI(3, c), \
+                                 HI(4, c), HI(5, c), HI(6, c), HI(7, c))
+
+/*======== static void load_rgb() ==========
+Splits the 8 pixels at p in to 16 bit red, green and blue lanes
+====================*/
+__attribute__((target("sse4.1")))
+static inline void load_rgb( pixel *p, __m128i *r, __m128i *g, __m128i *b ) {
+
+  __m128i lo = _mm_loadu_si128((__m128i *)p);
+  __m128i hi;
+
+  //8 packed pixels end 8 bytes after the first 16
+  if ( sizeof(pixel) == 3 )
+    hi = _mm_loadl_epi64((__m128i *)((unsigned char *)p + 16));
+  else
+    hi = _mm_loadu_si128((__m128i *)((unsigned char *)p + 16));
+  *r = _mm_or_si128(_mm_shuffle_epi8(lo, LO_MASK(0)), _mm_shuffle_epi8(hi, HI_MASK(0)));
+  *g = _mm_or_si128(_mm_shuffle_epi8(lo, LO_MASK(1)), _mm_shuffle_epi8(hi, HI_MASK(1)));
+  *b = _mm_or_si128(_mm_shuffle_epi8(lo, LO_MASK(2)), _mm_shuffle_epi8(hi, HI_MASK(2)));
+}
+
+/*======== static __m128i luma_sse41() ==========
+luma of 8 pixels in 16 bit lanes. The sum before the shift
+is at most 56228, which fits as long as it is unsigned.
+====================*/
+__attribute__((target("sse4.1")))
+static inline __m128i luma_sse41( __m128i r, __m128i g, __m128i b ) {
+
+  __m128i y;
+
+  y = _mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(66)),
+                    _mm_mullo_epi16(g, _mm_set1_epi16(129)));
+  y = _mm_add_epi16(y, _mm_mullo_epi16(b, _mm_set1_epi16(25)));
+  y = _mm_srli_epi16(_mm_add_epi16(y, _mm_set1_epi16(128)), 8);
+  return _mm_add_epi16(y, _mm_set1_epi16(16));
+}
+
+/*======== static void yuv_rows_sse41() ==========
+Same as yuv_rows_scalar, 8 pixels of both rows per step
+====================*/
+__attribute__((target("sse4.1")))
+static void yuv_rows_sse41( pixel *a, pixel *b, int width,
+                            unsigned char *ya, unsigned char *yb,
+                            unsigned char *u, unsigned char *v ) {
+
+  __m128i ra, ga, ba, rb, gb, bb, r, g, bl, c, ones = _mm_set1_epi16(1);
+  __m128i round = _mm_set1_epi32(512), mid = _mm_set1_epi32(128);
+  int x, packed;
+
+  for (x = 0; x + 8 <= width; x += 8) {
+    load_rgb(a + x, &ra, &ga, &ba);
+    load_rgb(b + x, &rb, &gb, &bb);
+    _mm_storel_epi64((__m128i *)(ya + x),
+                     _mm_packus_epi16(luma_sse41(ra, ga, ba), _mm_setzero_si128()));
+    if ( yb )
+      _mm_storel_epi64((__m128i *)(yb + x),
+                       _mm_packus_epi16(luma_sse41(rb, gb, bb), _mm_setzero_si128()));
+
+    //sums over each 2x2 block, 4 of them in 32 bit lanes
+    r = _mm_madd_epi16(_mm_add_epi16(ra, rb), ones);
+    g = _mm_madd_epi16(_mm_add_epi16(ga, gb), ones);
+    bl = _mm_madd_epi16(_mm_add_epi16(ba, bb), ones);
+
+    c = _mm_add_epi32(_mm_mullo_epi32(r, _mm_set1_epi32(-38)),
+                      _mm_mullo_epi32(g, _mm_set1_epi32(-74)));
+    c = _mm_add_epi32(c, _mm_mullo_epi32(bl, _mm_set1_epi32(112)));
+    c = _mm_add_epi32(_mm_srai_epi32(_mm_add_epi32(c, round), 10), mid);
+    c = _mm_packus_epi16(_mm_packs_epi32(c, c), c);
+    packed = _mm_cvtsi128_si32(c);
+    memcpy(u + x / 2, &packed, 4);
+
+    c = _mm_add_epi32(_mm_mullo_epi32(r, _mm_set1_epi32(112)),
+                      _mm_mullo_epi32(g, _mm_set1_epi32(-94)));
+    c = _mm_add_epi32(c, _mm_mullo_epi32(bl, _mm_set1_epi32(-18)));
+    c = _mm_add_epi32(_mm_srai_epi32(_mm_add_epi32(c, round), 10), mid);
+    c = _mm_packus_epi16(_mm_packs_epi32(c, c), c);
+    packed = _mm_cvtsi128_si32(c);
+    memcpy(v + x / 2, &packed, 4);
+  }
+  yuv_rows_scalar(a + x, b + x, width - x, ya + x, yb ? yb + x : NULL,
+                  u + x / 2, v + x / 2);
+}
+#endif
+
+/*======== static yuv_rows_fn pick_yuv_rows() ==========
+Inputs:
+Returns: The fastest row converter this CPU can run
+====================*/
+static yuv_rows_fn pick_yuv_rows() {
+#ifdef STREAM_X86
+  if ( __builtin_cpu_supports("sse4.1") )
+    return yuv_rows_sse41;
+#endif
+  return yuv_rows_scalar;
+}
+
+/*======== void rgb_to_yuv420() ==========
+Inputs:   screen s
+          unsigned char *y
+          unsigned char *u
+          unsigned char *v
+Returns:
+
+Converts s to a full size luma plane in y and half size
+(rounded up) chroma planes in u and v
+====================*/
+void rgb_to_yuv420( screen s, unsigned char *y, unsigned char *u, unsigned char *v ) {
+
+  static yuv_rows_fn yuv_rows = NULL;
+  int row, cw = (s->width + 1) / 2;
+  pixel *a, *b;
+
+  if ( !yuv_rows )
+    yuv_rows = pick_yuv_rows();
+  for (row = 0; row < s->height; row += 2) {
+    a = s->pixels + row * s->width;
+    b = row + 1 < s->height ? a + s->width : a;
+    yuv_rows(a, b, s->width, y + row * s->width,
+             row + 1 < s->height ? y + (row + 1) * s->width : NULL,
+             u + row / 2 * cw, v + row / 2 * cw);
+  }
+}
+
+/*======== struct video_stream *open_stream() ==========
+Inputs:   char *dest
+          int format
+          int delay
+Returns: A stream of frames shown for delay hundredths of a
+         second each, in format STREAM_Y4M or STREAM_RGB, or
+         NULL if dest could not be opened
+
+dest is a file or named pipe, or - for stdout. In that case
+anything printed from then on goes to stderr instead, so it
+does not end up in the video. The size of the video is taken
+from its first frame.
+====================*/
+struct video_stream *open_stream( char *dest, int format, int delay ) {
+
+  struct video_stream *vs;
+  FILE *f;
+  int fd;
+
+  if ( !strcmp(dest, "-") ) {
+    fflush(stdout);
+    fd = dup(STDOUT_FILENO);
+    if ( fd < 0 || dup2(STDERR_FILENO, STDOUT_FILENO) < 0 )
+      return NULL;
+    f = fdopen(fd, "wb");
+  }
+  else
+    f = fopen(dest, "wb");
+  if ( !f )
+    return NULL;
+
+  //an encoder that quits early shows up as a failed write
+  //rather than killing us
+  signal(SIGPIPE, SIG_IGN);
+
+  vs = (struct video_stream *)calloc(1, sizeof(struct video_stream));
+  vs->f = f;
+  vs->format = format;
+  vs->delay = delay;
+  return vs;
+}
+
+/*======== void write_stream_frame() ==========
+Inputs:   struct video_stream *v
+          screen s
+Returns:
+
+Writes s to v as the next frame. Once a write has failed,
+the rest of the frames are dropped.
+====================*/
+void write_stream_frame( struct video_stream *v, screen s ) {
+
+  size_t luma_size, chroma_size;
+
+  if ( v->failed )
+    return;
+  luma_size = (size_t)s->width * s->height;
+  chroma_size = (size_t)((s->width + 1) / 2) * ((s->height + 1) / 2);
+  if ( !v->width ) {
+    v->width = s->width;
+    v->height = s->height;
+    if ( v->format == STREAM_Y4M ) {
+      v->yuv = (unsigned char *)malloc(luma_size + 2 * chroma_size);
+      fprintf(v->f, "YUV4MPEG2 W%d H%d F100:%d Ip A1:1 C420jpeg\n",
+              v->width, v->height, v->delay);
+    }
+  }
+  if ( s->width != v->width || s->height != v->height ) {
+    fprintf(stderr, "error: %dx%d frame in a %dx%d video stream\n",
+            s->width, s->height, v->width, v->height);
+    v->failed = 1;
+    return;
+  }
+
+  if ( v->format == STREAM_Y4M ) {
+    rgb_to_yuv420(s, v->yuv, v->yuv + luma_size, v->yuv + luma_size + chroma_size);
+    fputs("FRAME\n", v->f);
+    fwrite(v->yuv, 1, luma_size + 2 * chroma_size, v->f);
+  }
+  else
+    write_rgb(s, v->f);
+
+  if ( fflush(v->f) || ferror(v->f) ) {
+    fprintf(stderr, "error: video stream closed after %d frames\n", v->frames);
+    v->failed = 1;
+    return;
+  }
+  v->frames++;
+}
+
+/*======== int close_stream() ==========
+Inputs:   struct video_stream *v
+Returns: 0 if every frame was written, -1 otherwise
+
+Closes and frees v
+====================*/
+int close_stream( struct video_stream *v ) {
+
+  int err = v->failed;
+
+  if ( fclose(v->f) )
+    err = 1;
+  free(v->yuv);
+  free(v);
+  return err ? -1 : 0;
+}
@@ -0,0 +1,33 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <stdio.h>
+
+#include "ml6.h"
+
+//stream formats
+#define STREAM_Y4M 0
+#define STREAM_RGB 1
+
+/*
+  Frames written one after another to a pipe, file or stdout,
+  either as YUV4MPEG2 (4:2:0) or as bare RGB24 images. The
+  size is 0x0 until the first frame sets it. yuv holds the
+  three planes of one Y4M frame.
+*/
+struct video_stream {
+  FILE *f;
+  int format;
+  int width, height;
+  int delay;
+  int frames;
+  int failed;
+  unsigned char *yuv;
+};
+
+struct video_stream *open_stream( char *dest, int format, int delay );
+void write_stream_frame( struct video_stream *v, screen s );
+int close_stream( struct video_stream *v );
+void rgb_to_yuv420( screen s, unsigned char *y, unsigned char *u, unsigned char *v );
+
+#endif